@@ -12,6 +12,7 @@
 
 #include "klee/Expr/Constraints.h"
 #include "klee/Expr/Expr.h"
+#include "klee/Internal/ADT/DecisionPath.h"
 #include "klee/Internal/ADT/TreeStream.h"
 #include "klee/Internal/System/Time.h"
 #include "klee/Interpreter.h"
@@ -96,6 +97,13 @@ public:
   /// taken to reach/create this state
   TreeOStream symPathOS;
 
+  /// @brief Every decision taken at a fork (0 or 1) or a multi-way branch
+  /// (index of the successor) on this path, where the condition did not
+  /// already decide which way to go. Only recorded for work
+  /// stealing and checkpoints, which replay it to rebuild this state.
+  /// Shared with the states this one was forked from.
+  DecisionPath decisions;
+
   /// @brief Counts how many instructions were executed since the last new
   /// instruction was covered.
   unsigned instsSinceCovNew;
@@ -120,6 +128,13 @@ public:
   /// @brief Known persistent / non-volatile MemoryObjects.
   std::set<const MemoryObject *> persistentObjects;
 
+  /// @brief Persistent MemoryObjects with flushes pending in the current
+  /// epoch, i.e., the only ones the next fence has to commit.
+  std::set<const MemoryObject *> epochFlushedObjects;
+
+  /// @brief Pmem regions (klee_pmem_alloc_pmem mappings) by base address.
+  std::map<uint64_t, std::shared_ptr<const PersistentRegion> > persistentRegions;
+
   /// @brief Set of used array names for this state.  Used to avoid collisions.
   std::set<std::string> arrayNames;
 
@@ -180,6 +195,13 @@ public:
   void notifyOne(wlist_id_t wlist, thread_uid_t tid);
   void notifyAll(wlist_id_t wlist);
 
+  /// @brief Find the pmem region containing the given address, if any.
+  const PersistentRegion *findPersistentRegion(uint64_t address) const;
+
+  /// @brief Unbind the object, and forget it as persistent memory, along
+  /// with the pmem region it is a chunk of.
+  void unbindObject(const MemoryObject *mo);
+
   /* Debugging helper */
   void dumpConstraints(llvm::raw_ostream &out) const;
   void dumpConstraints() const;
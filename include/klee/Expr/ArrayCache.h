@@ -27,6 +27,19 @@ struct EquivArrayCmpFn {
   }
 };
 
+/// Constant arrays with the same contents, whatever their names.
+struct ConstantArrayHashFn {
+  unsigned operator()(const Array *array) const;
+};
+
+struct ConstantArrayCmpFn {
+  bool operator()(const Array *array1, const Array *array2) const {
+    return array1->domain == array2->domain &&
+           array1->range == array2->range &&
+           array1->constantValues == array2->constantValues;
+  }
+};
+
 /// Provides an interface for creating and destroying Array objects.
 class ArrayCache {
 public:
@@ -59,6 +72,19 @@ public:
                            Expr::Width _domain = Expr::Int32,
                            Expr::Width _range = Expr::Int8);
 
+  /// Create a constant Array like CreateArray, unless one with the same
+  /// contents, domain and range was created by this method before. That one
+  /// is returned then, under the name it was created with.
+  ///
+  /// Arrays are only deleted with the cache, so this keeps constant arrays
+  /// that are built again and again from the same contents, like the
+  /// snapshots of compacted update lists, from piling up.
+  const Array *CreateSharedConstantArray(
+      const std::string &_name, uint64_t _size,
+      const ref<ConstantExpr> *constantValuesBegin,
+      const ref<ConstantExpr> *constantValuesEnd,
+      Expr::Width _domain = Expr::Int32, Expr::Width _range = Expr::Int8);
+
 private:
   typedef std::unordered_set<const Array *, klee::ArrayHashFn,
                              klee::EquivArrayCmpFn>
@@ -66,6 +92,8 @@ private:
   ArrayHashMap cachedSymbolicArrays;
   typedef std::vector<const Array *> ArrayPtrVec;
   ArrayPtrVec concreteArrays;
+  std::unordered_set<const Array *, ConstantArrayHashFn, ConstantArrayCmpFn>
+      sharedConstantArrays;
 };
 }
 
@@ -56,6 +56,14 @@ public:
   const_iterator end() const { return constraints.cend(); }
   std::size_t size() const noexcept { return constraints.size(); }
 
+  /// Whether every constraint of this set is also in other.
+  bool isSubsetOf(const ConstraintManager &other) const {
+    for (const auto &e : constraints)
+      if (!other.constraints.count(e))
+        return false;
+    return true;
+  }
+
   bool operator==(const ConstraintManager &other) const {
     return constraints == other.constraints;
   }
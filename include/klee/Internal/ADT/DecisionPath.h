@@ -0,0 +1,89 @@
+//===-- DecisionPath.h ------------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef KLEE_DECISIONPATH_H
+#define KLEE_DECISIONPATH_H
+
+#include <cstddef>
+#include <vector>
+
+namespace klee {
+  /// An immutable sequence of decisions that shares its prefix with the
+  /// paths it was copied from. Copying is O(1), and appending to a copy
+  /// only adds one node, so the paths of all states together take memory
+  /// proportional to the execution tree rather than states times depth.
+  ///
+  /// The reference counts are not atomic, paths must not be shared between
+  /// threads.
+  class DecisionPath {
+    struct Node {
+      unsigned refCount;
+      unsigned decision;
+      std::size_t length;
+      Node *parent;
+    };
+
+    Node *last = nullptr;
+
+    /// Iteratively, a long path must not recurse once per node.
+    static void release(Node *n) {
+      while (n && --n->refCount == 0) {
+        Node *parent = n->parent;
+        delete n;
+        n = parent;
+      }
+    }
+
+    explicit DecisionPath(Node *n) : last(n) {
+      if (last) ++last->refCount;
+    }
+
+  public:
+    DecisionPath() = default;
+    DecisionPath(const DecisionPath &other) : DecisionPath(other.last) {}
+    DecisionPath(DecisionPath &&other) : last(other.last) {
+      other.last = nullptr;
+    }
+    ~DecisionPath() { release(last); }
+
+    DecisionPath &operator=(DecisionPath other) {
+      std::swap(last, other.last);
+      return *this;
+    }
+
+    void push_back(unsigned decision) {
+      // The new node takes over the reference to the old last one.
+      last = new Node{1, decision, size() + 1, last};
+    }
+
+    bool empty() const { return !last; }
+    std::size_t size() const { return last ? last->length : 0; }
+
+    /// The last decision, the path must not be empty.
+    unsigned back() const { return last->decision; }
+    /// The path without its last decision, which is shared.
+    DecisionPath parent() const {
+      return DecisionPath(last ? last->parent : nullptr);
+    }
+
+    /// Equal for paths that share all of their nodes. Paths with the same
+    /// decisions that were built separately are different.
+    const void *identity() const { return last; }
+
+    std::vector<unsigned> toVector() const {
+      std::vector<unsigned> res(size());
+      std::size_t i = res.size();
+      for (const Node *n = last; n; n = n->parent)
+        res[--i] = n->decision;
+      return res;
+    }
+  };
+}
+
+#endif /* KLEE_DECISIONPATH_H */
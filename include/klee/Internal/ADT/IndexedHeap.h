@@ -0,0 +1,61 @@
+//===-- IndexedHeap.h -------------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef KLEE_INDEXEDHEAP_H
+#define KLEE_INDEXEDHEAP_H
+
+#include <cstddef>
+#include <functional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace klee {
+  /// A d-ary heap holding each item at most once. Items are indexed, so
+  /// their key can be changed or they can be removed in O(log n), rather
+  /// than lazily. Like std::priority_queue, top() is the greatest item
+  /// according to Compare.
+  template <class T, class Key, class Compare = std::less<Key>,
+            unsigned Arity = 4>
+  class IndexedHeap {
+    static_assert(Arity >= 2, "a heap needs at least two children per node");
+
+  public:
+    IndexedHeap(const Compare &compare = Compare()) : compare(compare) {}
+
+    bool empty() const { return heap.empty(); }
+    std::size_t size() const { return heap.size(); }
+    bool inHeap(const T &item) const { return index.count(item); }
+
+    /// Inserts item, or changes its key if it is already in the heap.
+    void insert(const T &item, const Key &key);
+    void update(const T &item, const Key &newKey);
+    void remove(const T &item);
+    void clear();
+
+    const T &top() const { return heap.front().first; }
+    const Key &topKey() const { return heap.front().second; }
+    const Key &getKey(const T &item) const;
+
+  private:
+    typedef std::pair<T, Key> Entry;
+
+    std::vector<Entry> heap;
+    std::unordered_map<T, std::size_t> index;
+    Compare compare;
+
+    void place(std::size_t pos, Entry entry);
+    void siftUp(std::size_t pos);
+    void siftDown(std::size_t pos);
+  };
+}
+
+#include "IndexedHeap.inc"
+
+#endif /* KLEE_INDEXEDHEAP_H */
@@ -41,11 +41,31 @@ namespace klee {
     int *operands;
     /// Destination register index.
     unsigned dest;
+    /// Index of this instruction in its KFunction's instructions.
+    unsigned index;
+    /// Properties of the instruction, computed when the module is loaded so
+    /// that per-step hooks can bail out on a single bit test. See Flags.
+    unsigned flags = 0;
     /// How many times this Instruction has been executed
     /// Maintained at Executor::executeInstruction
     unsigned int frequency = 0;
 
   public:
+    enum Flags : unsigned {
+      IsCall = 1u << 0,
+      IsReturn = 1u << 1,
+      IsStore = 1u << 2,
+      /// A call or invoke producing a pointer (e.g. an NVM allocation site).
+      ReturnsPointer = 1u << 3,
+
+      /// Instructions whose memory operations may refine NVM value states.
+      MayUpdateNvm = IsStore | ReturnsPointer,
+      /// Instructions which may change the NVM context of the state.
+      MayChangeNvmContext = IsCall | IsReturn,
+    };
+
+    static unsigned computeFlags(const llvm::Instruction *inst);
+
     virtual ~KInstruction();
     std::string getSourceLocation() const;
     unsigned int getLoadedFreq() const;
@@ -41,6 +41,10 @@ public:
 
   virtual void incPathsExplored() = 0;
 
+  /// Called in a newly forked exploration worker, which should write all
+  /// further output to a directory of its own.
+  virtual void redirectOutputToWorker(unsigned worker) = 0;
+
   virtual void processTestCase(const ExecutionState &state,
                                const char *err,
                                const char *suffix) = 0;
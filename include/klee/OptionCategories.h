@@ -17,6 +17,7 @@
 #include "llvm/Support/CommandLine.h"
 
 namespace klee {
+  extern llvm::cl::OptionCategory CheckerCat;
   extern llvm::cl::OptionCategory DebugCat;
   extern llvm::cl::OptionCategory MergeCat;
   extern llvm::cl::OptionCategory ModuleCat;
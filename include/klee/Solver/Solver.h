@@ -268,6 +268,11 @@ namespace klee {
 
   // Create a solver based on the supplied ``CoreSolverType``.
   Solver *createCoreSolver(CoreSolverType cst);
+
+  /// After fork(), a process still shares with its parent the memory in
+  /// which a forked core solver passes back its results. Call this in the
+  /// new process before it solves anything, to give it its own.
+  void renewForkedSolverMemory();
 }
 
 #endif /* KLEE_SOLVER_H */
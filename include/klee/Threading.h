@@ -44,12 +44,16 @@
 namespace klee {
 
 class CallPathNode;
+struct CallStackNode;
 struct Cell;
 class MemoryObject;
 struct StackFrame {
   KInstIterator caller;
   KFunction *kf;
   CallPathNode *callPathNode;
+  /// Interned call stack up to this frame, filled in lazily by
+  /// RootCauseManager::getCallStack.
+  mutable CallStackNode *callStack;
 
   std::vector<const MemoryObject *> allocas;
   Cell *locals;
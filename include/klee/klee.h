@@ -207,6 +207,16 @@ extern "C" {
    */
   void klee_pmem_check_persisted(void *addr, size_t size);
 
+  /* Flush every cache line overlapping [addr, addr+size), like a loop of
+   * clwb/clflushopt over the range (e.g. libpmem's pmem_flush), but in one
+   * step.
+   */
+  void klee_pmem_flush_range(void *addr, size_t size);
+
+  /* klee_pmem_flush_range followed by a fence (e.g. libpmem's pmem_persist).
+   */
+  void klee_pmem_persist_range(void *addr, size_t size);
+
   /* Assert that any recent modifications to the memory within range
    * [addrA, addrA+sizeA) are guaranteed to be persisted before any
    * recent modifications to the memory within range [addrB, sizeB).
@@ -0,0 +1,235 @@
+//===-- Checkpoint.cpp ------------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "Checkpoint.h"
+
+#include "Varint.h"
+
+#include "klee/Internal/Module/KInstruction.h"
+#include "klee/Internal/Module/KModule.h"
+#include "klee/Internal/Support/ErrorHandling.h"
+
+#include "llvm/IR/Module.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+using namespace llvm;
+using namespace klee;
+
+static const char CheckpointMagic[] = "KLEECKPT";
+static const size_t CheckpointMagicSize = sizeof(CheckpointMagic) - 1;
+static const unsigned CheckpointVersion = 3;
+
+bool Checkpoint::write(const std::string &path, std::string &error) const {
+  std::string data(CheckpointMagic, CheckpointMagicSize);
+  VarintWriter w(data);
+  w.number(CheckpointVersion);
+  w.string(moduleHash);
+
+  // Every node of the tree the paths form is numbered once, after its
+  // parent. 0 is the empty path.
+  std::unordered_map<const void *, uint64_t> ids;
+  std::vector<std::pair<uint64_t, unsigned> > nodes;
+  std::vector<uint64_t> paths;
+  for (const ReplayPath &path : frontier) {
+    std::vector<DecisionPath> missing;
+    DecisionPath p = path.decisions;
+    uint64_t parent = 0;
+    while (!p.empty()) {
+      auto it = ids.find(p.identity());
+      if (it != ids.end()) {
+        parent = it->second;
+        break;
+      }
+      DecisionPath next = p.parent();
+      missing.push_back(std::move(p));
+      p = std::move(next);
+    }
+
+    // The frontier keeps the paths alive, and with them the identities.
+    for (auto it = missing.rbegin(), ie = missing.rend(); it != ie; ++it) {
+      nodes.emplace_back(parent, it->back());
+      parent = nodes.size();
+      ids[it->identity()] = parent;
+    }
+    paths.push_back(parent);
+  }
+
+  w.number(nodes.size());
+  for (const auto &node : nodes) {
+    w.number(node.first);
+    w.number(node.second);
+  }
+  w.number(paths.size());
+  for (size_t i = 0; i < paths.size(); ++i) {
+    w.number(paths[i]);
+    w.number(frontier[i].steppedInstructions);
+  }
+
+  w.number(rootCauses.size());
+  for (const std::string &line : rootCauses)
+    w.string(line);
+
+  // Ascending, so the differences are small.
+  w.number(covered.size());
+  unsigned last = 0;
+  for (unsigned id : covered) {
+    w.number(id - last);
+    last = id;
+  }
+
+  w.number(statistics.size());
+  for (const auto &stat : statistics) {
+    w.string(stat.first);
+    w.number(stat.second);
+  }
+
+  std::string tmpPath = path + ".tmp";
+  {
+    std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+    out.write(data.data(), data.size());
+    out.flush();
+    if (!out) {
+      error = "unable to write " + tmpPath;
+      return false;
+    }
+  }
+
+  if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+    error = "unable to rename " + tmpPath + ": " + strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+bool Checkpoint::read(const std::string &path, std::string &error) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    error = "unable to open " + path;
+    return false;
+  }
+  std::string data((std::istreambuf_iterator<char>(in)),
+                   std::istreambuf_iterator<char>());
+
+  if (data.compare(0, CheckpointMagicSize, CheckpointMagic) != 0) {
+    error = path + " is not a checkpoint";
+    return false;
+  }
+
+  VarintReader r(data.data() + CheckpointMagicSize,
+                 data.data() + data.size());
+  if (r.number() != CheckpointVersion || r.failed) {
+    error = path + " is a checkpoint of an unsupported version";
+    return false;
+  }
+  moduleHash = r.string();
+
+  std::vector<DecisionPath> nodes(1);
+  uint64_t numNodes = r.count();
+  for (uint64_t i = 0; i < numNodes && !r.failed; ++i) {
+    uint64_t parent = r.number();
+    unsigned decision = r.number();
+    if (parent >= nodes.size()) {
+      r.failed = true;
+      break;
+    }
+    DecisionPath path = nodes[parent];
+    path.push_back(decision);
+    nodes.push_back(std::move(path));
+  }
+
+  frontier.clear();
+  uint64_t numPaths = r.count();
+  for (uint64_t i = 0; i < numPaths && !r.failed; ++i) {
+    uint64_t id = r.number();
+    uint64_t steppedInstructions = r.number();
+    if (id >= nodes.size()) {
+      r.failed = true;
+      break;
+    }
+    frontier.push_back({nodes[id], steppedInstructions});
+  }
+
+  rootCauses.clear();
+  uint64_t numRootCauses = r.count();
+  for (uint64_t i = 0; i < numRootCauses && !r.failed; ++i)
+    rootCauses.push_back(r.string());
+
+  covered.clear();
+  uint64_t numCovered = r.count();
+  unsigned last = 0;
+  for (uint64_t i = 0; i < numCovered && !r.failed; ++i) {
+    last += r.number();
+    covered.push_back(last);
+  }
+
+  statistics.clear();
+  uint64_t numStatistics = r.count();
+  for (uint64_t i = 0; i < numStatistics && !r.failed; ++i) {
+    std::string name = r.string();
+    statistics.emplace_back(name, r.number());
+  }
+
+  if (r.failed || !r.atEnd()) {
+    error = path + " is truncated or corrupt";
+    return false;
+  }
+  return true;
+}
+
+/***/
+
+ModuleNumbering::ModuleNumbering(const KModule &kmodule)
+    : kmodule(kmodule), numbering(*kmodule.module) {
+  for (const auto &kf : kmodule.functions) {
+    for (unsigned i = 0; i < kf->numInstructions; ++i)
+      kinsts[kf->instructions[i]->inst] = kf->instructions[i];
+  }
+}
+
+// 0 is null, the other IDs are one more than in the numbering.
+uint64_t ModuleNumbering::encode(const Value *v) const {
+  if (!v) return 0;
+  uint64_t id;
+  if (numbering.getId(v, id)) return id + 1;
+  klee_warning_once(v, "a root cause refers to a value that the checkpoint "
+                    "cannot name, it is not resumed");
+  return NotNumbered;
+}
+
+uint64_t ModuleNumbering::encode(const KInstruction *ki) const {
+  return ki ? encode(ki->inst) : 0;
+}
+
+uint64_t ModuleNumbering::encode(const KFunction *kf) const {
+  return kf ? encode(kf->function) : 0;
+}
+
+const Value *ModuleNumbering::decodeValue(uint64_t id) const {
+  const std::vector<Value *> &values = numbering.values();
+  return id && id <= values.size() ? values[id - 1] : nullptr;
+}
+
+const KInstruction *ModuleNumbering::decodeInstruction(uint64_t id) const {
+  const Instruction *i = dyn_cast_or_null<Instruction>(decodeValue(id));
+  if (!i) return nullptr;
+  auto it = kinsts.find(i);
+  return it == kinsts.end() ? nullptr : it->second;
+}
+
+KFunction *ModuleNumbering::decodeFunction(uint64_t id) const {
+  const Function *f = dyn_cast_or_null<Function>(decodeValue(id));
+  if (!f) return nullptr;
+  auto it = kmodule.functionMap.find(const_cast<Function *>(f));
+  return it == kmodule.functionMap.end() ? nullptr : it->second;
+}
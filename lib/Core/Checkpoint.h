@@ -0,0 +1,77 @@
+//===-- Checkpoint.h --------------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef KLEE_CHECKPOINT_H
+#define KLEE_CHECKPOINT_H
+
+#include "NvmAnalysisUtils.h"
+#include "ReplayTree.h"
+#include "RootCause.h"
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace klee {
+
+  /// What --checkpoint-interval saves of a run, so that --resume-from can
+  /// continue it.
+  ///
+  /// A state is not stored itself, but as the fork and branch decisions that
+  /// lead to it from the initial state (see ExecutionState::decisions). It
+  /// is rebuilt by replaying them, like a work stealing job. The paths are
+  /// stored as the tree they form, each node once, so a prefix that many
+  /// states share is stored once, and read back shared again. Each state
+  /// also keeps how many instructions it had executed, see ReplayPath.
+  struct Checkpoint {
+    /// The module that is explored, see utils::hashModule.
+    std::string moduleHash;
+    std::vector<ReplayPath> frontier;
+    /// Serialized by the RootCauseManager, with a ModuleNumbering.
+    std::vector<std::string> rootCauses;
+    /// The IDs of the covered instructions.
+    std::vector<unsigned> covered;
+    /// The global value of every statistic, by name.
+    std::vector<std::pair<std::string, uint64_t> > statistics;
+
+    /// The previous checkpoint at path is only replaced once this one is
+    /// written completely.
+    bool write(const std::string &path, std::string &error) const;
+    bool read(const std::string &path, std::string &error);
+  };
+
+  /// Refers to the values of a module by their ID in utils::ValueNumbering,
+  /// which is the same in every run of the same module. A value that is not
+  /// numbered, like a constant expression that no instruction uses, is
+  /// encoded as NotNumbered, so that the root cause it is part of is
+  /// rejected when it is read back rather than merged with another one.
+  class ModuleNumbering : public RootCauseCodec {
+    const KModule &kmodule;
+    utils::ValueNumbering numbering;
+    std::unordered_map<const llvm::Instruction *, const KInstruction *> kinsts;
+
+  public:
+    static const uint64_t NotNumbered = UINT64_MAX;
+
+    explicit ModuleNumbering(const KModule &kmodule);
+
+    uint64_t encode(const llvm::Value *v) const override;
+    uint64_t encode(const KInstruction *ki) const override;
+    uint64_t encode(const KFunction *kf) const override;
+
+    const llvm::Value *decodeValue(uint64_t id) const override;
+    const KInstruction *decodeInstruction(uint64_t id) const override;
+    KFunction *decodeFunction(uint64_t id) const override;
+  };
+
+}
+
+#endif /* KLEE_CHECKPOINT_H */
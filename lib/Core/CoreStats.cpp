@@ -31,6 +31,8 @@ Statistic stats::uncoveredInstructions("UncoveredInstructions", "Iuncov");
 Statistic stats::nvmHeuristicTime("NvmHeuristicTime", "NvmHTime");
 Statistic stats::nvmOfflineTime("NvmOfflineTime", "NvmOffline");
 Statistic stats::nvmAndersenTime("NvmAndersenTime", "NvmATime");
+Statistic stats::nvmContextCacheHits("NvmContextCacheHits", "NvmCtxHits");
+Statistic stats::nvmContextCacheMisses("NvmContextCacheMisses", "NvmCtxMisses");
 
 Statistic stats::nvmBugsTotalUniq(
     "NvmBugsTotalUnique", "NvmBugsTotalUniq");
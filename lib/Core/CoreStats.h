@@ -52,6 +52,10 @@ namespace stats {
   extern Statistic nvmOfflineTime;
   extern Statistic nvmAndersenTime;
 
+  /// Lookups in the dynamic NVM heuristic's context cache.
+  extern Statistic nvmContextCacheHits;
+  extern Statistic nvmContextCacheMisses;
+
   /// (iangneal): Core NVM bug stats. We do this for graphing purposes.
   extern Statistic nvmBugsTotalUniq;
   extern Statistic nvmBugsTotalOccurences;
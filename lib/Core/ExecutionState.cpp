@@ -114,6 +114,7 @@ ExecutionState::ExecutionState(const ExecutionState& state):
 
     pathOS(state.pathOS),
     symPathOS(state.symPathOS),
+    decisions(state.decisions),
 
     instsSinceCovNew(state.instsSinceCovNew),
     coveredNew(state.coveredNew),
@@ -122,6 +123,8 @@ ExecutionState::ExecutionState(const ExecutionState& state):
     ptreeNode(state.ptreeNode),
     symbolics(state.symbolics),
     persistentObjects(state.persistentObjects),
+    epochFlushedObjects(state.epochFlushedObjects),
+    persistentRegions(state.persistentRegions),
     arrayNames(state.arrayNames),
     openMergeStack(state.openMergeStack),
     steppedInstructions(state.steppedInstructions),
@@ -340,18 +343,40 @@ void ExecutionState::popFrame(Thread &t) {
     assert(os && "trying to unbind null!");
     const PersistentState *ps = dyn_cast<PersistentState>(os);
     if (ps) {
-      auto rootCauses = executor_->markPersistenceErrors(*this, mo, ps);
+      auto rootCauses = executor_->markPersistenceErrors(*this, {mo});
       if (rootCauses.size()) {
         klee_warning("ERROR: alloca pmem error");
       }
-      persistentObjects.erase(mo);
     }
-    addressSpace.unbindObject(mo);
+    unbindObject(mo);
   }
   
   t.stack.pop_back();
 }
 
+const PersistentRegion *
+ExecutionState::findPersistentRegion(uint64_t address) const {
+  auto it = persistentRegions.upper_bound(address);
+  if (it == persistentRegions.begin()) return nullptr;
+  --it;
+  return it->second->contains(address) ? it->second.get() : nullptr;
+}
+
+void ExecutionState::unbindObject(const MemoryObject *mo) {
+  persistentObjects.erase(mo);
+  epochFlushedObjects.erase(mo);
+
+  // Without the chunk, the rest is no longer one mapping. The range may be
+  // mapped again with other objects.
+  const PersistentRegion *region = findPersistentRegion(mo->address);
+  if (region && region->getChunk(mo->address) == mo) {
+    uint64_t address = region->address;
+    persistentRegions.erase(address);
+  }
+
+  addressSpace.unbindObject(mo);
+}
+
 /* Multithreading related function  */
 Thread &ExecutionState::createThread(thread_id_t tid, KFunction *kf) {
   // we currently assume there is only one process and its id is 0
@@ -10,6 +10,7 @@
 #include "Executor.h"
 
 #include "../Expr/ArrayExprOptimizer.h"
+#include "Checkpoint.h"
 #include "Context.h"
 #include "CoreStats.h"
 #include "CustomCheckerHandler.h"
@@ -17,13 +18,16 @@
 #include "ImpliedValue.h"
 #include "Memory.h"
 #include "MemoryManager.h"
+#include "NvmAnalysisUtils.h"
 #include "PTree.h"
+#include "PersistencyModel.h"
 #include "Searcher.h"
 #include "SeedInfo.h"
 #include "SpecialFunctionHandler.h"
 #include "StatsTracker.h"
 #include "TimingSolver.h"
 #include "UserSearcher.h"
+#include "WorkStealing.h"
 #include "ExecutorDebugHelper.h"
 
 #include "klee/Common.h"
@@ -76,13 +80,19 @@
 #include <algorithm>
 #include <cassert>
 #include <cerrno>
+#include <cstring>
 #include <cxxabi.h>
+#include <fcntl.h>
 #include <fstream>
 #include <iomanip>
 #include <iosfwd>
 #include <sstream>
 #include <string>
+#include <sys/file.h>
 #include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include <vector>
 #include <cpuid.h>
 
@@ -180,6 +190,61 @@ cl::opt<bool>
                                   "querying the solver (default=true)"),
                          cl::cat(SolvingCat));
 
+/*** Persistent memory checker options ***/
+
+cl::opt<std::string> RootCauseDB(
+    "root-cause-db",
+    cl::desc("Also append the persistent memory bugs found to this root-cause "
+             "database, which many runs can share. Merge databases with "
+             "klee-pmem-merge (default: none)"),
+    cl::init(""),
+    cl::cat(CheckerCat));
+
+cl::opt<bool> ForkOnSymbolicFlush(
+    "fork-on-symbolic-flush", cl::init(true),
+    cl::desc("Fork on whether a flushed cache line lies before, after or "
+             "inside each persistent object it may overlap.  Otherwise, "
+             "make one conditional flush of the clamped offset per object "
+             "(default=true)"),
+    cl::cat(CheckerCat));
+
+
+/*** Exploration options ***/
+
+cl::opt<unsigned> ExplorationWorkers(
+    "exploration-workers",
+    cl::desc("Split the exploration between this many worker processes, "
+             "each with its own solver chain and output directory "
+             "worker-<i>, once there are enough states (default=1)"),
+    cl::init(1),
+    cl::cat(SearchCat));
+
+cl::opt<bool> WorkStealing(
+    "work-stealing",
+    cl::desc("With --exploration-workers, run a coordinator process that "
+             "hands out subtrees of the execution tree to idle workers, "
+             "instead of splitting the states once (default=false)"),
+    cl::init(false),
+    cl::cat(SearchCat));
+
+cl::opt<std::string> CheckpointInterval(
+    "checkpoint-interval",
+    cl::desc("Periodically save the frontier of the exploration, the root "
+             "causes found, coverage and statistics to the file checkpoint "
+             "in the output directory, which --resume-from continues.  Set "
+             "to 0s to disable (default=0s)"),
+    cl::init("0s"),
+    cl::cat(SearchCat));
+
+cl::opt<std::string> ResumeFrom(
+    "resume-from",
+    cl::desc("Continue the exploration saved in this checkpoint (see "
+             "--checkpoint-interval).  Each state is rebuilt by replaying "
+             "its path, so use the same options (and --allocate-determ if "
+             "pointers are resolved symbolically) (default: none)"),
+    cl::init(""),
+    cl::cat(SearchCat));
+
 
 /*** External call policy options ***/
 
@@ -476,6 +541,15 @@ Executor::Executor(LLVMContext &ctx, const InterpreterOptions &opts,
         setHaltExecution(true);
       }));
 
+  const time::Span checkpointInterval{CheckpointInterval};
+  if (checkpointInterval) {
+    checkpointing = true;
+    recordDecisions = true;
+    timers.add(std::make_unique<Timer>(checkpointInterval, [&]{
+      writeCheckpoint();
+    }));
+  }
+
   coreSolverTimeout = time::Span{MaxCoreSolverTime};
   if (coreSolverTimeout) UseForkedCoreSolver = true;
   Solver *coreSolver = klee::createCoreSolver(CoreSolverToUse);
@@ -854,7 +928,29 @@ void Executor::branch(ExecutionState &state,
   unsigned N = conditions.size();
   assert(N);
 
-  if (MaxForks!=~0u && stats::forks >= MaxForks) {
+  // Only a branch with more than one successor is a decision, as in fork.
+  if (N > 1 && replayTree.replaying(&state)) {
+    // Only the successors that the replayed paths continue with.
+    result.assign(N, NULL);
+    ExecutionState *es = NULL;
+    for (unsigned i=0; i<N; ++i) {
+      if (!replayTree.follows(state, i))
+        continue;
+      if (!es) {
+        es = result[i] = &state;
+        continue;
+      }
+      ExecutionState *ns = es->branch();
+      replayTree.copy(*es, *ns);
+      addedStates.push_back(ns);
+      result[i] = ns;
+      processTree->attach(es->ptreeNode, ns, es);
+    }
+    if (!es) {
+      terminateStateEarly(state, "Replay of the path diverged.");
+      return;
+    }
+  } else if (MaxForks!=~0u && stats::forks >= MaxForks) {
     unsigned next = theRNG.getInt32() % N;
     for (unsigned i=0; i<N; ++i) {
       if (i == next) {
@@ -881,6 +977,12 @@ void Executor::branch(ExecutionState &state,
     }
   }
 
+  if (N > 1) {
+    for (unsigned i=0; i<N; ++i)
+      if (result[i])
+        recordDecision(*result[i], i);
+  }
+
   // If necessary redistribute seeds to match conditions, killing
   // states if necessary due to OnlyReplaySeeds (inefficient but
   // simple).
@@ -979,8 +1081,33 @@ Executor::fork(ExecutionState &current, ref<Expr> condition, bool isInternal) {
     return StatePair(0, 0);
   }
 
+  // Only where the condition could go either way is a decision recorded or
+  // replayed. That is not the case for most branches, constant conditions
+  // included.
+  bool decided = res != Solver::Unknown;
+
   if (!isSeeding) {
-    if (replayPath && !isInternal) {
+    if (!decided && replayTree.replaying(&current)) {
+      // Only the sides that the replayed paths continue with, and a fork
+      // below if they continue with both.
+      bool takeTrue = replayTree.follows(current, 1);
+      bool takeFalse = replayTree.follows(current, 0);
+      if (!takeTrue && !takeFalse) {
+        current.pc() = current.prevPC();
+        terminateStateEarly(current, "Replay of the path diverged.");
+        return StatePair(0, 0);
+      }
+
+      if (takeTrue != takeFalse) {
+        if (takeTrue) {
+          res = Solver::True;
+          addConstraint(current, condition);
+        } else {
+          res = Solver::False;
+          addConstraint(current, Expr::createIsZero(condition));
+        }
+      }
+    } else if (replayPath && !isInternal) {
       assert(replayPosition<replayPath->size() &&
              "ran out of branches in replay path mode");
       bool branch = (*replayPath)[replayPosition++];
@@ -1072,6 +1199,8 @@ Executor::fork(ExecutionState &current, ref<Expr> condition, bool isInternal) {
         current.pathOS << "1";
       }
     }
+    if (!decided)
+      recordDecision(current, 1);
 
     return StatePair(&current, 0);
   } else if (res==Solver::False) {
@@ -1080,6 +1209,8 @@ Executor::fork(ExecutionState &current, ref<Expr> condition, bool isInternal) {
         current.pathOS << "0";
       }
     }
+    if (!decided)
+      recordDecision(current, 0);
 
     return StatePair(0, &current);
   } else {
@@ -1089,6 +1220,7 @@ Executor::fork(ExecutionState &current, ref<Expr> condition, bool isInternal) {
     ++stats::forks;
 
     falseState = trueState->branch();
+    replayTree.copy(*trueState, *falseState);
     addedStates.push_back(falseState);
 
     if (it != seedMap.end()) {
@@ -1143,6 +1275,8 @@ Executor::fork(ExecutionState &current, ref<Expr> condition, bool isInternal) {
         falseState->symPathOS << "0";
       }
     }
+    recordDecision(*trueState, 1);
+    recordDecision(*falseState, 0);
 
     addConstraint(*trueState, condition);
     addConstraint(*falseState, Expr::createIsZero(condition));
@@ -1158,6 +1292,12 @@ Executor::fork(ExecutionState &current, ref<Expr> condition, bool isInternal) {
   }
 }
 
+void Executor::recordDecision(ExecutionState &state, unsigned decision) {
+  if (recordDecisions)
+    state.decisions.push_back(decision);
+  replayTree.take(state, decision);
+}
+
 void Executor::addConstraint(ExecutionState &state, ref<Expr> condition) {
   if (ConstantExpr *CE = dyn_cast<ConstantExpr>(condition)) {
     if (!CE->isTrue())
@@ -1988,7 +2128,8 @@ void Executor::executeInstruction(ExecutionState &state, KInstruction *ki) {
 
     // terminate error state
     if (result) {
-      terminateStateOnExecError(*branches.back(), "indirectbr: illegal label address");
+      if (branches.back())
+        terminateStateOnExecError(*branches.back(), "indirectbr: illegal label address");
       branches.pop_back();
     }
 
@@ -2964,6 +3105,13 @@ void Executor::executeInstruction(ExecutionState &state, KInstruction *ki) {
 }
 
 void Executor::updateStates(ExecutionState *current) {
+  // A replaying state stops once it is back where it was, see ReplayPath.
+  if (current && !replayTree.empty())
+    replayTree.arrive(*current);
+  // A job is done replaying once it is back where it was, or gone.
+  if (workChannel && replayTree.empty())
+    rootCauseMgr->setCounting(true);
+
   /**
    * (iangneal): Update the heuristic first, so that the priorities are up
    * to date for the NvmPathSearcher.
@@ -3124,24 +3272,520 @@ void Executor::doDumpStates() {
   updateStates(nullptr);
 }
 
+static void appendToRootCauseDB(const std::string &path,
+                                const std::string &records) {
+  int fd = open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+  if (fd < 0) {
+    klee_warning("unable to open root-cause database %s: %s", path.c_str(),
+                 strerror(errno));
+    return;
+  }
+
+  // Runs that finish at the same time must not interleave their records.
+  if (flock(fd, LOCK_EX) < 0)
+    klee_warning("unable to lock root-cause database %s: %s", path.c_str(),
+                 strerror(errno));
+
+  const char *data = records.data();
+  size_t left = records.size();
+  while (left) {
+    ssize_t n = write(fd, data, left);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      klee_warning("unable to write root-cause database %s: %s", path.c_str(),
+                   strerror(errno));
+      break;
+    }
+    data += n;
+    left -= n;
+  }
+
+  close(fd);
+}
+
 void Executor::dumpRootCauses() {
   auto textPtr = interpreterHandler->openOutputFile("all.pmem.err");
   auto csvPtr = interpreterHandler->openOutputFile("all_pmem_errs.csv");
-  assert(textPtr && csvPtr && "could not open files!");
+  auto dbPtr = interpreterHandler->openOutputFile("root-causes.db");
+  assert(textPtr && csvPtr && dbPtr && "could not open files!");
   
   interpreterHandler->getInfoStream() << rootCauseMgr->getSummary();
   rootCauseMgr->dumpText(*textPtr);
   rootCauseMgr->dumpCSV(*csvPtr);
+
+  std::string run = llvm::sys::path::parent_path(
+      interpreterHandler->getOutputFilename("root-causes.db")).str();
+  std::string records;
+  llvm::raw_string_ostream os(records);
+  rootCauseMgr->dumpDatabase(os, run);
+  *dbPtr << os.str();
+
+  // A work stealing coordinator appends what its workers found.
+  if (!RootCauseDB.empty() && !workChannel)
+    appendToRootCauseDB(RootCauseDB, os.str());
+}
+
+void Executor::flushOutputsBeforeFork() {
+  // Anything still buffered would be written once by every worker.
+  interpreterHandler->getInfoStream().flush();
+  if (statsTracker)
+    statsTracker->flushOutputs();
+  llvm::outs().flush();
+  llvm::errs().flush();
+  fflush(nullptr);
+}
+
+void Executor::splitExploration() {
+  explorationSplit = true;
+  flushOutputsBeforeFork();
+
+  for (unsigned i = 1; i < ExplorationWorkers; ++i) {
+    pid_t pid = ::fork();
+    if (pid == 0) {
+      workerIndex = i;
+      workerPids.clear();
+      renewForkedSolverMemory();
+      // The first process reports the bugs found before the split.
+      rootCauseMgr->excludeFromDatabase();
+      break;
+    }
+    if (pid < 0) {
+      klee_warning("unable to fork exploration worker %u: %s", i,
+                   strerror(errno));
+      break;
+    }
+    workerPids.push_back(pid);
+  }
+
+  if (workerIndex) {
+    interpreterHandler->redirectOutputToWorker(workerIndex);
+    if (statsTracker)
+      statsTracker->reopenOutputs();
+  }
+
+  // Every worker sees the same states in the same order, so dealing them
+  // out round-robin gives each a disjoint share without any coordination.
+  unsigned index = 0;
+  for (ExecutionState *es : states) {
+    unsigned owner = index++ % ExplorationWorkers;
+    // The first process keeps the share of any worker it could not start.
+    if (workerIndex == 0 && owner > workerPids.size())
+      owner = 0;
+    if (owner != workerIndex) {
+      es->pc() = es->prevPC();
+      removedStates.push_back(es);
+    }
+  }
+  updateStates(nullptr);
+
+  if (workerIndex == 0)
+    klee_message("split exploration between %u workers",
+                 (unsigned) workerPids.size() + 1);
+  klee_message("exploration worker %u continues with %u states", workerIndex,
+               (unsigned) states.size());
+}
+
+void Executor::waitForWorkers() {
+  for (pid_t pid : workerPids) {
+    int status;
+    pid_t res;
+    do {
+      res = waitpid(pid, &status, 0);
+    } while (res < 0 && errno == EINTR);
+
+    if (res < 0)
+      klee_warning("unable to wait for exploration worker %d: %s", pid,
+                   strerror(errno));
+    else if (!WIFEXITED(status) || WEXITSTATUS(status))
+      klee_warning("exploration worker %d did not exit cleanly", pid);
+  }
+
+  if (!workerPids.empty())
+    klee_message("the results of the other exploration workers are in their "
+                 "worker-<i> output directories");
+  workerPids.clear();
+}
+
+bool Executor::startWorkStealing(ExecutionState &initialState) {
+  if (usingSeeds || replayKTest || replayPath)
+    klee_error("--work-stealing cannot be combined with seeding or replay");
+
+  explorationSplit = true;
+  flushOutputsBeforeFork();
+
+  std::unique_ptr<WorkCoordinator> coordinator(new WorkCoordinator());
+  for (unsigned i = 1; i <= ExplorationWorkers; ++i) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+      klee_error("unable to create socket for exploration worker: %s",
+                 strerror(errno));
+
+    pid_t pid = ::fork();
+    if (pid < 0)
+      klee_error("unable to fork exploration worker %u: %s", i,
+                 strerror(errno));
+
+    if (pid == 0) {
+      // Also closes the sockets of the workers forked before this one.
+      coordinator.reset();
+      close(fds[0]);
+      workerPids.clear();
+      workerIndex = i;
+      workChannel.reset(new WorkChannel(fds[1]));
+      recordDecisions = true;
+      renewForkedSolverMemory();
+
+      interpreterHandler->redirectOutputToWorker(workerIndex);
+      if (statsTracker)
+        statsTracker->reopenOutputs();
+
+      setJobRoot(initialState);
+      return false;
+    }
+
+    close(fds[1]);
+    coordinator->addWorker(pid, fds[0]);
+    workerPids.push_back(pid);
+  }
+
+  klee_message("coordinating %u exploration workers",
+               (unsigned) ExplorationWorkers);
+
+  std::vector<std::unordered_map<uint64_t, uint64_t> > rootCauseIds(
+      ExplorationWorkers);
+  coordinator->run(
+      [&](unsigned worker, const std::string &message) {
+        mergeWorkerResult(rootCauseIds[worker], message);
+      },
+      [&]() {
+        timers.invoke();
+        return haltExecution;
+      });
+  coordinator.reset();
+  waitForWorkers();
+
+  // The coordinator never runs a state itself.
+  removedStates.push_back(&initialState);
+  updateStates(nullptr);
+  return true;
+}
+
+void Executor::mergeWorkerResult(
+    std::unordered_map<uint64_t, uint64_t> &rootCauseIds,
+    const std::string &message) {
+  std::istringstream is(message);
+  std::string kind;
+  is >> kind;
+
+  if (kind == "rc") {
+    if (!rootCauseMgr->merge(message, rootCauseIds))
+      klee_warning("ignoring malformed root cause from exploration worker");
+  } else if (kind == "cov") {
+    size_t n;
+    unsigned id;
+    is >> n;
+    while (statsTracker && n-- && is >> id)
+      statsTracker->markCovered(id);
+  } else {
+    klee_warning("ignoring unknown message from exploration worker: %s",
+                 kind.c_str());
+  }
+}
+
+void Executor::setJobRoot(ExecutionState &initialState) {
+  jobRoot = &initialState;
+  states.erase(&initialState);
+
+  // A searcher that walks the process tree, like random-path, must never
+  // reach the initial state. It has not run yet, so it is the only leaf.
+  assert(processTree->root->state == &initialState &&
+         !processTree->root->left && !processTree->root->right);
+  processTree->root->state = nullptr;
+  initialState.ptreeNode = nullptr;
+}
+
+ExecutionState *Executor::startReplay() {
+  ExecutionState *es = jobRoot->branch();
+
+  // The state becomes the root of an empty process tree, or else shares
+  // the leaf of a live state.
+  if (states.empty()) {
+    PTreeNode *root = processTree->root.get();
+    assert(!root->left && !root->right && "process tree without states");
+    root->state = es;
+    es->ptreeNode = root;
+  } else {
+    ExecutionState *other = *states.begin();
+    processTree->attach(other->ptreeNode, es, other);
+  }
+
+  replayTree.start(*es);
+  addedStates.push_back(es);
+  updateStates(nullptr);
+  return es;
+}
+
+bool Executor::takeJob() {
+  if (!workChannel || !workChannel->send("idle"))
+    return false;
+
+  std::string message;
+  while (workChannel->receive(message, true)) {
+    if (message == "exit")
+      return false;
+
+    if (message == "steal") {
+      workChannel->send("nojob");
+      continue;
+    }
+
+    ReplayPath job;
+    if (!WorkChannel::decodeJob(message, job)) {
+      klee_warning("ignoring unknown message from the coordinator: %s",
+                   message.substr(0, message.find(' ')).c_str());
+      continue;
+    }
+
+    // The worker that gave the job away counted the bugs on the way to it.
+    // Counting resumes once the state is back where it was, see
+    // updateStates.
+    rootCauseMgr->setCounting(false);
+    replayTree.add(job);
+    startReplay();
+    return true;
+  }
+
+  klee_warning("lost the connection to the coordinator");
+  return false;
+}
+
+void Executor::serveCoordinator() {
+  std::string message;
+  while (workChannel->receive(message, false)) {
+    if (message == "exit") {
+      haltExecution = true;
+      continue;
+    }
+
+    if (message != "steal") {
+      klee_warning("ignoring unknown message from the coordinator: %s",
+                   message.c_str());
+      continue;
+    }
+
+    // Give away the shallowest state, which likely has the largest subtree
+    // left to explore. A job that is still being replayed has only one.
+    ExecutionState *donated = nullptr;
+    if (replayTree.empty() && states.size() > 1) {
+      for (ExecutionState *es : states) {
+        if (!donated || es->depth < donated->depth)
+          donated = es;
+      }
+    }
+
+    if (!donated) {
+      workChannel->send("nojob");
+      continue;
+    }
+
+    workChannel->send(WorkChannel::encodeJob(
+        {donated->decisions, donated->steppedInstructions}));
+    donated->pc() = donated->prevPC();
+    removedStates.push_back(donated);
+    updateStates(nullptr);
+  }
+}
+
+void Executor::sendWorkerResults() {
+  std::vector<std::string> lines;
+  rootCauseMgr->serialize(lines);
+  for (const std::string &line : lines)
+    workChannel->send(line);
+
+  if (statsTracker) {
+    std::vector<unsigned> covered;
+    statsTracker->getCoveredInstructions(covered);
+
+    std::ostringstream os;
+    os << "cov " << covered.size();
+    for (unsigned id : covered)
+      os << " " << id;
+    workChannel->send(os.str());
+  }
+
+  workChannel->send("done");
+  workChannel.reset();
+}
+
+void Executor::numberModule() {
+  if (moduleNumbering)
+    return;
+  moduleHash = utils::hashModule(*kmodule->module);
+  moduleNumbering.reset(new ModuleNumbering(*kmodule));
+}
+
+void Executor::writeCheckpoint(bool halting) {
+  numberModule();
+
+  Checkpoint checkpoint;
+  checkpoint.moduleHash = moduleHash;
+  // Timers run before the states of the last step are updated.
+  auto live = [&](const ExecutionState *es) {
+    return std::find(removedStates.begin(), removedStates.end(), es) ==
+           removedStates.end();
+  };
+  // A state that still replays is saved as the paths it has left.
+  auto save = [&](const ExecutionState *es) {
+    if (!live(es))
+      return;
+    if (replayTree.replaying(es))
+      replayTree.pending(*es, checkpoint.frontier);
+    else
+      checkpoint.frontier.push_back({es->decisions, es->steppedInstructions});
+  };
+  for (const ExecutionState *es : states)
+    save(es);
+  for (const ExecutionState *es : addedStates)
+    save(es);
+  checkpoint.frontier.insert(checkpoint.frontier.end(), resumePending.begin(),
+                             resumePending.end());
+
+  rootCauseMgr->serialize(checkpoint.rootCauses, *moduleNumbering);
+  if (statsTracker)
+    statsTracker->getCoveredInstructions(checkpoint.covered);
+  for (unsigned i = 0; i < theStatisticManager->getNumStatistics(); ++i) {
+    const Statistic &stat = theStatisticManager->getStatistic(i);
+    checkpoint.statistics.emplace_back(stat.getName(),
+                                       theStatisticManager->getValue(stat));
+  }
+
+  std::string path = interpreterHandler->getOutputFilename("checkpoint");
+  std::string error;
+  if (!checkpoint.write(path, error)) {
+    klee_warning("unable to write checkpoint: %s", error.c_str());
+    return;
+  }
+
+  if (halting && !checkpoint.frontier.empty())
+    klee_message("saved %u remaining states in %s, continue with "
+                 "--resume-from", (unsigned) checkpoint.frontier.size(),
+                 path.c_str());
+}
+
+void Executor::resumeFromCheckpoint(ExecutionState &initialState) {
+  Checkpoint checkpoint;
+  std::string error;
+  if (!checkpoint.read(ResumeFrom, error))
+    klee_error("unable to resume: %s", error.c_str());
+
+  numberModule();
+  if (checkpoint.moduleHash != moduleHash)
+    klee_error("unable to resume: %s was saved for a different module",
+               ResumeFrom.c_str());
+
+  std::unordered_map<uint64_t, uint64_t> rootCauseIds;
+  for (const std::string &line : checkpoint.rootCauses) {
+    if (!rootCauseMgr->merge(line, rootCauseIds, *moduleNumbering))
+      klee_warning("ignoring malformed root cause in %s", ResumeFrom.c_str());
+  }
+
+  klee_message("resuming %u states from %s",
+               (unsigned) checkpoint.frontier.size(), ResumeFrom.c_str());
+
+  // As in a work stealing worker, the states are replayed from a copy of
+  // the initial state, which never runs itself. They are replayed together
+  // and only fork where their paths part, so every decision of the
+  // checkpoint is taken once.
+  recordDecisions = true;
+  setJobRoot(initialState);
+  unsigned paths = 0;
+  for (const ReplayPath &path : checkpoint.frontier) {
+    if (replayTree.add(path))
+      ++paths;
+  }
+
+  // The checkpoint already counted the bugs on the way to its states.
+  rootCauseMgr->setCounting(false);
+
+  // Without paths, there is nothing to resume.
+  ExecutionState *es = paths ? startReplay() : nullptr;
+  while (!replayTree.empty() && !haltExecution) {
+    // Stay with a state until it is done, the others wait where they were
+    // forked.
+    if (!replayTree.replaying(es))
+      es = replayTree.anyReplaying();
+
+    KInstruction *ki = es->pc();
+    stepInstruction(*es);
+
+    executeInstruction(*es, ki);
+    if (EnableCustomCheckers) {
+      assert(customCheckerHandler);
+      customCheckerHandler->handle(*es);
+    }
+    timers.invoke();
+    updateStates(es);
+  }
+
+  if (!replayTree.empty()) {
+    // Halted in the middle, the paths that are left are saved again.
+    std::vector<ExecutionState *> replaying = replayTree.replayingStates();
+    for (ExecutionState *state : replaying)
+      replayTree.pending(*state, resumePending);
+    for (ExecutionState *state : replaying) {
+      replayTree.remove(*state);
+      state->pc() = state->prevPC();
+      removedStates.push_back(state);
+    }
+    updateStates(nullptr);
+  }
+
+  rootCauseMgr->setCounting(true);
+
+  if (statsTracker) {
+    for (unsigned id : checkpoint.covered)
+      statsTracker->markCovered(id);
+  }
+  // The replay counted some statistics again, the checkpoint has the real
+  // values.
+  for (const auto &stat : checkpoint.statistics) {
+    if (Statistic *s = theStatisticManager->getStatisticByName(stat.first))
+      theStatisticManager->setValue(*s, stat.second);
+  }
+
+  // Every replayed path that did not diverge left a state.
+  if (!haltExecution && states.size() < paths)
+    klee_warning("%u states of the checkpoint could not be replayed",
+                 paths - (unsigned) states.size());
 }
 
 void Executor::run(ExecutionState &initialState) {
   bindModuleConstants();
 
+  if (ExplorationWorkers > 1 && (pathWriter || symPathWriter))
+    klee_error("--exploration-workers cannot be combined with --write-paths "
+               "or --write-sym-paths");
+  if (ExplorationWorkers > 1 && (checkpointing || !ResumeFrom.empty()))
+    klee_error("--exploration-workers cannot be combined with "
+               "--checkpoint-interval or --resume-from");
+  if (!ResumeFrom.empty() && (usingSeeds || replayKTest || replayPath))
+    klee_error("--resume-from cannot be combined with seeding or replay");
+
   // Delay init till now so that ticks don't accrue during optimization and such.
   timers.reset();
 
   states.insert(&initialState);
 
+  if (!ResumeFrom.empty())
+    resumeFromCheckpoint(initialState);
+
+  if (ExplorationWorkers > 1 && WorkStealing &&
+      startWorkStealing(initialState)) {
+    dumpRootCauses();
+    return;
+  }
+
   if (usingSeeds) {
     std::vector<SeedInfo> &v = seedMap[&initialState];
 
@@ -3154,6 +3798,8 @@ void Executor::run(ExecutionState &initialState) {
     ExecutionState *lastState = 0;
     while (!seedMap.empty()) {
       if (haltExecution) {
+        if (checkpointing)
+          writeCheckpoint(true);
         doDumpStates();
         dumpRootCauses();
         return;
@@ -3230,7 +3876,7 @@ void Executor::run(ExecutionState &initialState) {
   // (iangneal): XXX the way that this searcher works is that it can delete some
   // states it doesn't want to run. So, at this point, we could already have
   // 0 states to check. So, I'm adding the searcher empty check.
-  while (!states.empty() && !haltExecution) {
+  while (!haltExecution && (!states.empty() || takeJob())) {
     if (!searcher->empty()) {
       ExecutionState &state = searcher->selectStateAndUpdateInfo();
       KInstruction *ki = state.pc();
@@ -3249,6 +3895,13 @@ void Executor::run(ExecutionState &initialState) {
       checkMemoryUsage();
 
       updateStates(&state);
+
+      if (ExplorationWorkers > 1 && !explorationSplit &&
+          states.size() >= ExplorationWorkers)
+        splitExploration();
+
+      if (workChannel && stats::instructions % 1000 == 0)
+        serveCoordinator();
     } else {
       updateStates(nullptr);
     }
@@ -3257,8 +3910,13 @@ void Executor::run(ExecutionState &initialState) {
   delete searcher;
   searcher = nullptr;
 
+  if (checkpointing)
+    writeCheckpoint(true);
   doDumpStates();
   dumpRootCauses();
+  if (workChannel)
+    sendWorkerResults();
+  waitForWorkers();
 }
 
 std::string Executor::getAddressInfo(ExecutionState &state,
@@ -3319,6 +3977,7 @@ void Executor::terminateState(ExecutionState &state) {
   }
 
   interpreterHandler->incPathsExplored();
+  replayTree.remove(state);
 
   std::vector<ExecutionState *>::iterator it =
       std::find(addedStates.begin(), addedStates.end(), &state);
@@ -3741,7 +4400,7 @@ void Executor::executeAlloc(ExecutionState &state,
         unsigned count = std::min(reallocFrom->size, os->size);
         for (unsigned i=0; i<count; i++)
           os->write(state, i, reallocFrom->read8(i));
-        state.addressSpace.unbindObject(reallocFrom->getObject());
+        state.unbindObject(reallocFrom->getObject());
       }
     }
   } else {
@@ -3848,7 +4507,7 @@ void Executor::executeFree(ExecutionState &state,
         terminateStateOnError(*it->second, "free of global", Free, NULL,
                               getAddressInfo(*it->second, address));
       } else {
-        it->second->addressSpace.unbindObject(mo);
+        it->second->unbindObject(mo);
         if (target)
           bindLocal(target, *it->second, Expr::createPointer(0));
       }
@@ -3912,12 +4571,19 @@ void Executor::executeMemoryOperation(ExecutionState &state,
           ObjectState *wos = state.addressSpace.getWriteable(mo, os);
           wos->write(state, offset, value);
           if (PersistentState *ps = dyn_cast<PersistentState>(wos)) {
-            if (isNontemporal) {
+            const PersistencyModel &model = PersistencyModel::get();
+            if (model.fencePersistsWrites()) {
+              // The write is persisted by the next fence, unless it only
+              // touched ignored bytes, which dirty nothing.
+              if (!ps->isIgnoredRange(state, offset, bytes))
+                state.epochFlushedObjects.insert(mo);
+            } else if (isNontemporal && model.tracksFlushes()) {
               // llvm::errs() << "nontemporal store! " << mo->address << ": " << *offset << "\n";
 
               // Nontemporal writes don't dirty the cache, but they must
               // still cause an error until a fence happens.
               ps->persistCacheLineAtOffset(state, offset);
+              state.epochFlushedObjects.insert(mo);
             }
           }
         }
@@ -4071,6 +4737,8 @@ void Executor::executeUpdateNvmInfo(ExecutionState &state,
                                     KInstruction *loc, 
                                     const ObjectState *cos) {
   if (state.nvmInfo() && loc && cos) {
+    // Other operations (e.g. loads) cannot refine the value state.
+    if (!(loc->flags & KInstruction::MayUpdateNvm)) return;
     assert(cos->getObject() && "I don't know what to do!");
     if (!cos->getObject()->allocSite) {
       // errs() << __func__ << " object: " << cos->getObject()->name << "\n";
@@ -4089,10 +4757,24 @@ void Executor::executeUpdateNvmInfo(ExecutionState &state,
 void Executor::executePersistentMemoryFlush(ExecutionState &state,
                                             const MemoryObject *mo,
                                             PersistentState *ps,
-                                            ref<Expr> offset) {
-  // Check if offset already flushed.
-  ref<Expr> check = ps->getIsOffsetPersistedExpr(offset,
-                                                 true /* allow pending */);
+                                            ref<Expr> offset,
+                                            ref<Expr> condition) {
+  // A flush that cannot apply persists nothing and must not make the next
+  // fence necessary. One that must apply is an ordinary flush.
+  if (!isa<ConstantExpr>(condition)) {
+    Solver::Validity res;
+    bool success = solver->evaluate(state, condition, res);
+    assert(success && "FIXME: Unhandled solver failure");
+    if (res == Solver::False) return;
+    if (res == Solver::True) condition = ConstantExpr::create(1, Expr::Bool);
+  } else if (cast<ConstantExpr>(condition)->isFalse()) {
+    return;
+  }
+
+  // Check if offset already flushed (whenever the flush applies).
+  ref<Expr> check = OrExpr::create(Expr::createIsZero(condition),
+                                   ps->getIsOffsetPersistedExpr(offset,
+                                                                true /* allow pending */));
   bool isAlreadyPersisted;
   bool success = solver->mustBeTrue(state, check, isAlreadyPersisted);
   assert(success && "FIXME: Unhandled solver failure");
@@ -4110,12 +4792,17 @@ void Executor::executePersistentMemoryFlush(ExecutionState &state,
     // klee_warning("Good Flush");
     // errs() << mo->address << ": " << *offset << "\n";
     // state.dumpStack();
-    ps->persistCacheLineAtOffset(state, offset);
+    ps->persistCacheLineAtOffset(state, offset, condition);
+    // Here the flush applies on some path at least, and its pending persist
+    // has to be committed by the next fence.
+    state.epochFlushedObjects.insert(mo);
   }
 }
 
 void Executor::executePersistentMemoryFlush(ExecutionState &state,
                                             ref<Expr> address) {
+  if (!PersistencyModel::get().tracksFlushes()) return;
+
   address = optimizer.optimizeExpr(address, true);
 
   ref<Expr> rangeBegin = memory->alignToCache(address);
@@ -4143,6 +4830,7 @@ void Executor::executePersistentMemoryFlush(ExecutionState &state,
 
   if (incomplete) {
     terminateStateEarly(state, "Query timed out (resolve).");
+    return;
   } else if (rl.empty()) {
     terminateStateOnError(state, "memory error: out of bound pointer", Ptr,
                           NULL, getAddressInfo(state, address));
@@ -4164,6 +4852,26 @@ void Executor::executePersistentMemoryFlush(ExecutionState &state,
       // If offset >= object size, then the object's *last* cache line
       // still overlaps with the cache line being flushed.
 
+      if (!ForkOnSymbolicFlush) {
+        // Clamp the offset into the object instead of forking, and only 
+        // flush if the cache line overlaps the object at all.
+        Expr::Width width = Context::get().getPointerWidth();
+        ref<Expr> offset = mo->getOffsetExpr(address);
+        ref<Expr> clamped = SelectExpr::create(
+            UltExpr::create(address, mo->getBaseExpr()),
+            ConstantExpr::create(0, width),
+            SelectExpr::create(UgeExpr::create(offset, mo->getSizeExpr()),
+                               ConstantExpr::create(mo->size - 1, width),
+                               offset));
+        ref<Expr> objectEnd = ConstantExpr::create(mo->address + mo->size, 
+                                                   width);
+        ref<Expr> overlaps = AndExpr::create(
+            UltExpr::create(rangeBegin, objectEnd),
+            UgtExpr::create(rangeEnd, mo->getBaseExpr()));
+        executePersistentMemoryFlush(state, mo, ps, clamped, overlaps);
+        continue;
+      }
+
       // If address less than object base, flush offset 0
       ref<Expr> check = UltExpr::create(address, mo->getBaseExpr());
       StatePair result = fork(state, check, true);
@@ -4171,7 +4879,8 @@ void Executor::executePersistentMemoryFlush(ExecutionState &state,
       ExecutionState *remaining = result.second;
       if (less) {
         ref<Expr> firstByte = ConstantExpr::create(0, Expr::Int32);
-        executePersistentMemoryFlush(*less, mo, ps, firstByte);
+        executePersistentMemoryFlush(*less, mo, ps, firstByte,
+                                     ConstantExpr::create(1, Expr::Bool));
       }
 
       // Definitely less than?
@@ -4187,14 +4896,16 @@ void Executor::executePersistentMemoryFlush(ExecutionState &state,
       remaining = result.second;
       if (greater) {
         ref<Expr> lastByte = ConstantExpr::create(mo->size - 1, Expr::Int32);
-        executePersistentMemoryFlush(*greater, mo, ps, lastByte);
+        executePersistentMemoryFlush(*greater, mo, ps, lastByte,
+                                     ConstantExpr::create(1, Expr::Bool));
       }
 
       // Definitely not in bounds?
       if (!remaining)
         continue;
 
-      executePersistentMemoryFlush(*remaining, mo, ps, offset);
+      executePersistentMemoryFlush(*remaining, mo, ps, offset,
+                                   ConstantExpr::create(1, Expr::Bool));
 
     } else {
       if (ConstantExpr *CE = dyn_cast<ConstantExpr>(address)) {
@@ -4207,19 +4918,120 @@ void Executor::executePersistentMemoryFlush(ExecutionState &state,
   }
 }
 
+void Executor::executePersistentMemoryFlushRange(ExecutionState &state,
+                                                 const MemoryObject *mo,
+                                                 PersistentState *ps,
+                                                 unsigned offset,
+                                                 unsigned size) {
+  unsigned lineSz = memory->getCacheAlignment();
+  unsigned end = offset + size;
+
+  // Lines that are already persisted are reported like single flushes, the
+  // runs of lines in between are persisted as a whole.
+  std::unordered_set<std::string> errStrs;
+  unsigned runStart = offset;
+  for (unsigned line = offset; line < end; ) {
+    unsigned next = std::min(end, (line / lineSz + 1) * lineSz);
+
+    ref<Expr> lineOffset = ConstantExpr::create(line, Expr::Int32);
+    ref<Expr> check = ps->getIsOffsetPersistedExpr(lineOffset,
+                                                   true /* allow pending */);
+    bool isAlreadyPersisted;
+    bool success = solver->mustBeTrue(state, check, isAlreadyPersisted);
+    assert(success && "FIXME: Unhandled solver failure");
+
+    if (isAlreadyPersisted) {
+      if (line > runStart) {
+        ps->persistRange(state, runStart, line - runStart);
+        state.epochFlushedObjects.insert(mo);
+      }
+      errStrs.insert(rootCauseMgr->getRootCauseString(
+          ps->markFlushAsBug(state, lineOffset)));
+      runStart = next;
+    }
+    line = next;
+  }
+
+  if (runStart < end) {
+    ps->persistRange(state, runStart, end - runStart);
+    state.epochFlushedObjects.insert(mo);
+  }
+
+  if (!errStrs.empty()) {
+    emitPmemError(state, errStrs);
+  }
+}
+
+void Executor::executePersistentMemoryFlushRange(ExecutionState &state,
+                                                 ref<Expr> address,
+                                                 uint64_t size) {
+  if (!size || !PersistencyModel::get().tracksFlushes()) return;
+
+  // A symbolic range would have to be split at every possible object
+  // boundary; concretize it instead.
+  address = optimizer.optimizeExpr(address, true);
+  uint64_t begin = toConstant(state, address, 
+                              "persistent memory flush range")->getZExtValue();
+  uint64_t end = begin + size;
+
+  Expr::Width width = Context::get().getPointerWidth();
+  ref<Expr> rangeBegin = ConstantExpr::create(memory->alignToCache(begin), width);
+  ref<Expr> rangeEnd = ConstantExpr::create(
+      memory->alignToCache(end - 1) + memory->getCacheAlignment(), width);
+
+  ResolutionList rl;
+  solver->setTimeout(coreSolverTimeout);
+  bool incomplete = state.addressSpace.resolveRange(state, solver,
+                                                    rangeBegin, rangeEnd,
+                                                    rl, 0, coreSolverTimeout);
+  solver->setTimeout(time::Span());
+
+  if (incomplete) {
+    terminateStateEarly(state, "Query timed out (resolve).");
+    return;
+  } else if (rl.empty()) {
+    terminateStateOnError(state, "memory error: out of bound pointer", Ptr,
+                          NULL, getAddressInfo(state, address));
+    return;
+  }
+
+  for (ResolutionList::iterator i = rl.begin(), ie = rl.end(); i != ie; ++i) {
+    const MemoryObject *mo = i->first;
+    const ObjectState *os = i->second;
+    if (isPersistentMemory(state, mo)) {
+      ObjectState *wos = state.addressSpace.getWriteable(mo, os);
+      PersistentState *ps = dyn_cast<PersistentState>(wos);
+
+      // As with single flushes, the range may only share its first or last 
+      // cache line with the object, in which case the object's last or 
+      // first byte is flushed.
+      uint64_t last = mo->address + mo->size - 1;
+      uint64_t lo = std::min(std::max(begin, mo->address), last);
+      uint64_t hi = std::min(std::max(end - 1, mo->address), last);
+      executePersistentMemoryFlushRange(state, mo, ps, lo - mo->address, 
+                                        hi - lo + 1);
+    } else {
+      klee_warning("Flushing volatile memory at address %lx", begin);
+    }
+  }
+}
+
 void Executor::executePersistentMemoryFence(ExecutionState &state) {
+  if (!PersistencyModel::get().tracksWrites()) return;
+
   // llvm::errs() << "Fence\n";
-  bool fenceNecessary = false;
-  for (const MemoryObject *mo : state.persistentObjects) {
+  // Only objects flushed during this epoch have anything to commit (writes
+  // are applied to both views eagerly), so there is no need to touch, and
+  // copy-on-write, the rest. Without any, the fence is unnecessary.
+  bool fenceNecessary = !state.epochFlushedObjects.empty();
+  for (const MemoryObject *mo : state.epochFlushedObjects) {
     const ObjectState *os = state.addressSpace.findObject(mo);
     assert(os);
     ObjectState *wos = state.addressSpace.getWriteable(mo, os);
     PersistentState *ps = dyn_cast<PersistentState>(wos);
-    bool commitNecessary = ps->commitPendingPersists(state);
-    // Only one needs to be true to make the commit necessary.
-    // I like doing this as a separate statement to avoid short circuit issues.
-    fenceNecessary = commitNecessary || fenceNecessary;
+    ps->commitPendingPersists(state);
   }
+  state.epochFlushedObjects.clear();
 
   if (!fenceNecessary) {
     auto id = rootCauseMgr->getRootCauseLocationID(state, nullptr, 
@@ -4232,40 +5044,94 @@ void Executor::executePersistentMemoryFence(ExecutionState &state) {
   }
 }
 
+/**
+ * Objects whose last verdict still applies are skipped. Lines that are
+ * decided without the solver are handled directly. For the rest, we ask for
+ * a single model in which some line of some object is unpersisted, take
+ * every line that is dirty in that model, and repeat with the remaining lines
+ * until none of them can be dirty.
+ */
 std::unordered_set<uint64_t> 
 Executor::markPersistenceErrors(ExecutionState &state, 
-                                const MemoryObject *mo,
-                                const PersistentState *ps) {
-  // Get a symbolic offset into the object and constrain it to be within
-  // the object's bounds.
-  auto anyOffset = ps->getAnyOffsetExpr();
-  auto inBoundsConstraint = mo->getBoundsCheckOffset(anyOffset);
-  state.constraints.addConstraint(inBoundsConstraint);
-
-  bool isPersisted = true;
-  bool success = solver->mustBeTrue(state, ps->getIsOffsetPersistedExpr(anyOffset),
-                                    isPersisted);
-  assert(success && "FIXME: Unhandled solver failure");
+                                const std::vector<const MemoryObject *> &mos) {
+  struct Candidate {
+    unsigned obj;
+    unsigned line;
+    ref<Expr> isDirty;
+  };
+
+  std::unordered_set<uint64_t> rootCauses;
+  std::vector<const PersistentState *> objs;
+  std::vector<std::vector<unsigned> > dirtyLines(mos.size());
+  std::vector<Candidate> candidates;
+  for (unsigned i = 0; i < mos.size(); ++i) {
+    const ObjectState *os = state.addressSpace.findObject(mos[i]);
+    assert(os);
+    const PersistentState *ps = dyn_cast<PersistentState>(os);
+    assert(ps);
+
+    std::unordered_set<uint64_t> cached;
+    if (ps->getCachedPersistenceVerdict(state, cached)) {
+      for (auto id : cached) {
+        rootCauseMgr->markAsBug(id);
+      }
+      rootCauses.insert(cached.begin(), cached.end());
+      objs.push_back(nullptr);
+      continue;
+    }
+    objs.push_back(ps);
 
-  state.constraints.removeConstraint(inBoundsConstraint);
+    std::vector<std::pair<unsigned, ref<Expr> > > maybeDirty;
+    ps->getUnpersistedCacheLines(dirtyLines[i], maybeDirty);
+    for (auto &p : maybeDirty) {
+      candidates.push_back({i, p.first, p.second});
+    }
+  }
 
-  if (!isPersisted) {
-    return ps->markNonPersistedWritesAsBugs(state);
+  while (!candidates.empty()) {
+    ref<Expr> anyDirty = ConstantExpr::create(0, Expr::Bool);
+    for (const Candidate &c : candidates) {
+      anyDirty = OrExpr::create(anyDirty, c.isDirty);
+    }
+
+    Assignment model;
+    bool hasModel;
+    bool success = solver->getModel(state, anyDirty, model, hasModel);
+    assert(success && "FIXME: Unhandled solver failure");
+    if (!hasModel) break;
+
+    std::vector<Candidate> remaining;
+    for (const Candidate &c : candidates) {
+      ref<Expr> isDirty = model.evaluate(c.isDirty);
+      if (isDirty->isTrue()) {
+        dirtyLines[c.obj].push_back(c.line);
+      } else {
+        remaining.push_back(c);
+      }
+    }
+    assert(remaining.size() < candidates.size() && "model dirties no line!");
+    candidates.swap(remaining);
   }
 
-  return std::unordered_set<uint64_t>();
+  for (unsigned i = 0; i < mos.size(); ++i) {
+    if (!objs[i]) continue;
+
+    std::unordered_set<uint64_t> ids;
+    if (!dirtyLines[i].empty()) {
+      std::sort(dirtyLines[i].begin(), dirtyLines[i].end());
+      ids = objs[i]->markNonPersistedWritesAsBugs(state, dirtyLines[i]);
+      rootCauses.insert(ids.begin(), ids.end());
+    }
+    objs[i]->cachePersistenceVerdict(state, ids);
+  }
+
+  return rootCauses;
 }
 
 bool Executor::getPersistenceErrors(ExecutionState &state,
-                                    const MemoryObject *mo,
+                                    const std::vector<const MemoryObject *> &mos,
                                     std::unordered_set<std::string> &errors) {
-
-  const ObjectState *os = state.addressSpace.findObject(mo);
-  assert(os);
-  const PersistentState *ps = dyn_cast<PersistentState>(os);
-  assert(ps);
-
-  auto rootCauses = markPersistenceErrors(state, mo, ps);
+  auto rootCauses = markPersistenceErrors(state, mos);
 
   if (rootCauses.empty()) return false;
 
@@ -4278,20 +5144,20 @@ bool Executor::getPersistenceErrors(ExecutionState &state,
 
 bool Executor::getAllPersistenceErrors(ExecutionState &state,
                                        std::unordered_set<std::string> &errors) {
-  bool hasErr = false;
-  if (state.persistentObjects.size()) {
-    for (const MemoryObject *mo : state.persistentObjects) {
-      if (haltExecution) {
-        klee_warning("Halting execution while solving for persistence errors. "
-                     "Results will be incomplete.");
-        return hasErr;
-      }
-      bool objHasErr = getPersistenceErrors(state, mo, errors);
-      hasErr = hasErr || objHasErr;
-    }
+  if (state.persistentObjects.empty() || 
+      !PersistencyModel::get().tracksWrites()) {
+    return false;
+  }
+
+  if (haltExecution) {
+    klee_warning("Halting execution while solving for persistence errors. "
+                 "Results will be incomplete.");
+    return false;
   }
 
-  return hasErr;
+  std::vector<const MemoryObject *> mos(state.persistentObjects.begin(),
+                                        state.persistentObjects.end());
+  return getPersistenceErrors(state, mos, errors);
 }
 
 /* Multi-threading related function */                                           
@@ -27,14 +27,18 @@
 #include "llvm/Support/raw_ostream.h"
 
 #include "../Expr/ArrayExprOptimizer.h"
+#include "ReplayTree.h"
 
 #include <map>
 #include <memory>
 #include <set>
 #include <string>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
+#include <sys/types.h>
+
 struct KTest;
 
 namespace llvm {
@@ -65,6 +69,7 @@ namespace klee {
   class KModule;
   class MemoryManager;
   class MemoryObject;
+  class ModuleNumbering;
   class ObjectState;
   class PTree;
   class Searcher;
@@ -74,6 +79,7 @@ namespace klee {
   class StatsTracker;
   class TimingSolver;
   class TreeStreamWriter;
+  class WorkChannel;
   class MergeHandler;
   class MergingSearcher;
   template<class T> class ref;
@@ -249,6 +255,43 @@ private:
   /// `nullptr` if merging is disabled
   MergingSearcher *mergingSearcher = nullptr;
 
+  /// Index of this process among the exploration workers, see
+  /// --exploration-workers. Only meaningful once \ref explorationSplit.
+  unsigned workerIndex = 0;
+  bool explorationSplit = false;
+
+  /// The worker processes forked by this process, which it waits for at
+  /// the end of \ref run.
+  std::vector<pid_t> workerPids;
+
+  /// With --work-stealing, the connection of a worker to the coordinator.
+  std::unique_ptr<WorkChannel> workChannel;
+
+  /// The initial state of a work stealing worker. It never runs itself,
+  /// every job is replayed from a copy of it. It is not part of the process
+  /// tree, see \ref setJobRoot.
+  ExecutionState *jobRoot = nullptr;
+
+  /// The paths that the states copied from \ref jobRoot replay, a single
+  /// one for a job, the whole frontier to resume from a checkpoint.
+  ReplayTree replayTree;
+
+  /// Whether states record their decisions, for work stealing and
+  /// checkpoints.
+  bool recordDecisions = false;
+
+  /// Whether --checkpoint-interval is set.
+  bool checkpointing = false;
+
+  /// The paths of the checkpoint that is resumed which were not replayed
+  /// when the run halted. Saved again instead of the states replaying them.
+  std::vector<ReplayPath> resumePending;
+
+  /// How checkpoints identify the module and refer to its values, see
+  /// \ref numberModule.
+  std::string moduleHash;
+  std::unique_ptr<ModuleNumbering> moduleNumbering;
+
   llvm::Function* getTargetFunction(llvm::Value *calledVal,
                                     ExecutionState &state);
   
@@ -351,10 +394,22 @@ private:
 
   void executePersistentMemoryFlush(ExecutionState &state,
                                     ref<Expr> address);
+  // Flush the cache line at offset into the object, if condition holds.
   void executePersistentMemoryFlush(ExecutionState &state,
                                     const MemoryObject *mo,
                                     PersistentState *ps,
-                                    ref<Expr> offset);
+                                    ref<Expr> offset,
+                                    ref<Expr> condition);
+  // Flush every cache line overlapping [address, address + size), with one
+  // pending persist per contiguous span of lines that still need it.
+  void executePersistentMemoryFlushRange(ExecutionState &state,
+                                         ref<Expr> address,
+                                         uint64_t size);
+  void executePersistentMemoryFlushRange(ExecutionState &state,
+                                         const MemoryObject *mo,
+                                         PersistentState *ps,
+                                         unsigned offset,
+                                         unsigned size);
 
   void executePersistentMemoryFence(ExecutionState &state);
 
@@ -370,11 +425,14 @@ private:
 
   /// Check persistence of all memory objects. Return ALL errors.
   bool getAllPersistenceErrors(ExecutionState &state, std::unordered_set<std::string> &errors);
-  bool getPersistenceErrors(ExecutionState &state, const MemoryObject *mo, std::unordered_set<std::string> &errors);
+  bool getPersistenceErrors(ExecutionState &state,
+                            const std::vector<const MemoryObject *> &mos,
+                            std::unordered_set<std::string> &errors);
   
-  std::unordered_set<uint64_t> markPersistenceErrors(ExecutionState &state, 
-                                                     const MemoryObject *mo, 
-                                                     const PersistentState *ps);
+  /// Check the persistence of the given objects in a batch, and mark the
+  /// root causes of their unpersisted lines as bugs.
+  std::unordered_set<uint64_t> markPersistenceErrors(
+      ExecutionState &state, const std::vector<const MemoryObject *> &mos);
 
   /// Create a new state where each input condition has been added as
   /// a constraint and return the results. The input state is included
@@ -521,6 +579,43 @@ private:
   /// @brief (iangneal): dump all the bugs in one place
   void dumpRootCauses();
 
+  /// Fork into the exploration worker processes and keep only this
+  /// worker's share of the current states.
+  void splitExploration();
+  void waitForWorkers();
+  void flushOutputsBeforeFork();
+
+  /// Fork the work stealing workers and coordinate them. Returns true in
+  /// the coordinator, once the exploration is over, and false in a worker.
+  bool startWorkStealing(ExecutionState &initialState);
+  void mergeWorkerResult(std::unordered_map<uint64_t, uint64_t> &rootCauseIds,
+                         const std::string &message);
+
+  /// Keep the initial state to replay jobs from, out of the set of states
+  /// and the process tree.
+  void setJobRoot(ExecutionState &initialState);
+  /// Add a copy of \ref jobRoot that replays \ref replayTree.
+  ExecutionState *startReplay();
+  /// Record the decision the state took where a fork or branch had more
+  /// than one way to go, and follow the path it replays.
+  void recordDecision(ExecutionState &state, unsigned decision);
+
+  /// In a work stealing worker: wait for the next job and start replaying
+  /// it, or return false once there is no work left.
+  bool takeJob();
+  /// In a work stealing worker: give up a state if the coordinator asks.
+  void serveCoordinator();
+  void sendWorkerResults();
+
+  /// Set up \ref moduleHash and \ref moduleNumbering, once.
+  void numberModule();
+  /// Save the frontier and the results so far, see --checkpoint-interval.
+  /// If halting, say how to continue.
+  void writeCheckpoint(bool halting = false);
+  /// Rebuild the frontier of the checkpoint to resume (see --resume-from)
+  /// by replaying the paths of its states, and restore its results.
+  void resumeFromCheckpoint(ExecutionState &initialState);
+
   /* Multi-threading related function */
   // Pthread Create needs to specify a new StackFrame instead of just using the
   // current thread's stack
@@ -12,6 +12,7 @@
 #include "Context.h"
 #include "MemoryManager.h"
 #include "ObjectHolder.h"
+#include "PersistencyModel.h"
 
 #include "klee/Expr/ArrayCache.h" 
 #include "klee/Expr/Expr.h"
@@ -45,6 +46,24 @@ namespace {
                     llvm::cl::desc("Use constant arrays instead of updates when possible (default=true)\n"),
                     llvm::cl::init(true),
                     llvm::cl::cat(SolvingCat));
+
+  llvm::cl::opt<bool>
+  DeferRootCauses("pmem-deferred-root-causes",
+                  llvm::cl::desc("Log persistent memory writes and flushes, and only "
+                                 "solve for their root causes when a bug is "
+                                 "reported (default=false)"),
+                  llvm::cl::init(false),
+                  llvm::cl::cat(CheckerCat));
+
+  llvm::cl::opt<unsigned>
+  CompactPmemUpdates("pmem-compact-updates",
+                     llvm::cl::desc("At a fence, fold the concrete prefix of a "
+                                    "persistent object's cache line and root "
+                                    "cause update lists into a constant array "
+                                    "once it is at least this long (0=off, "
+                                    "default=64)"),
+                     llvm::cl::init(64),
+                     llvm::cl::cat(CheckerCat));
 }
 
 /* #region ObjectHolder */
@@ -678,49 +697,27 @@ PersistentState::PersistentState(TimingSolver *solver,
     solver(solver),
     cacheLineUpdates(nullptr, nullptr),
     pendingCacheLineUpdates(nullptr, nullptr),
+    symbolicTracking(false),
     rootCauseWrites(nullptr, nullptr),
     pendingRootCauseWrites(nullptr, nullptr),
     rootCauseFlushes(nullptr, nullptr),
     pendingRootCauseFlushes(nullptr, nullptr),
+    persistedCacheLines(nullptr),
+    noRootCauseWrites(nullptr),
     rootCauseWidth(Expr::Int64),
-    rootCauseMgr(state.rootCauseMgr) {
+    rootCauseMgr(state.rootCauseMgr),
+    epoch(0),
+    version(0),
+    coalescingWrite(false) {
+
+  // Reserve the names of the tracking arrays. The arrays themselves are only
+  // created once a cache line of this object is dirtied or flushed (see
+  // createTrackingArrays), so untouched parts of a large pool stay cheap.
+  getUniqueArrayName(state, "_cacheLines");
+  getUniqueArrayName(state, "_rootCauseWrites");
+  getUniqueArrayName(state, "_rootCauseFlushes");
 
-  // Set up all the symbolic Arrays we need.
   ArrayCache *arrayCache = getArrayCache();
-  const MemoryObject *object = getObject();
-  uint64_t size = object->parent->getSizeInCacheLines(object->size);
-
-  // For initializing values
-  std::vector<ref<ConstantExpr> > Init(size);
-
-  // First, the symbolic cache line tracking array (initialize to persisted).
-  Init.assign(size, getPersistedExpr());
-  auto cacheLinesName = getUniqueArrayName(state, "_cacheLines");
-  const Array *cacheLines = arrayCache->CreateArray(cacheLinesName, size,
-                                                    &Init[0], &Init[0] + size,
-                                                    Expr::Int32 /* domain */,
-                                                    Expr::Int8 /* range */);
-  cacheLineUpdates = UpdateList(cacheLines, nullptr);
-  pendingCacheLineUpdates = UpdateList(cacheLineUpdates);
-
-  // Set up the root causes symbolic array (initialize to nullptr).
-  Init.assign(size, getNullptr());
-  auto rootWritesName = getUniqueArrayName(state, "_rootCauseWrites");
-  const Array *rootWrites = arrayCache->CreateArray(rootWritesName, size,
-                                                    &Init[0], &Init[0] + size,
-                                                    Expr::Int32 /* domain */,
-                                                    rootCauseWidth /* range */);
-  rootCauseWrites = UpdateList(rootWrites, nullptr);
-  pendingRootCauseWrites = UpdateList(rootCauseWrites);
-
-  Init.assign(size, getNullptr());
-  auto rootFlushesName = getUniqueArrayName(state, "_rootCauseFlushes");
-  const Array *rootFlushes = arrayCache->CreateArray(rootFlushesName, size,
-                                                     &Init[0], &Init[0] + size,
-                                                     Expr::Int32 /* domain */,
-                                                     rootCauseWidth /* range */);
-  rootCauseFlushes = UpdateList(rootFlushes, nullptr);
-  pendingRootCauseFlushes = UpdateList(rootCauseFlushes);
 
   // Set up a symbolic integer to act as an "arbitrary offset" into this.
   auto idxArrayName = getUniqueArrayName(state, "_idx");
@@ -743,6 +740,11 @@ PersistentState::PersistentState(const PersistentState &ps)
     cacheLineUpdates(ps.cacheLineUpdates),
     pendingCacheLineUpdates(ps.pendingCacheLineUpdates),
 
+    symbolicTracking(ps.symbolicTracking),
+    dirtyLines(ps.dirtyLines),
+    pendingDirtyLines(ps.pendingDirtyLines),
+    epochFlushedLines(ps.epochFlushedLines),
+
     idxUnbounded(ps.idxUnbounded),
 
     rootCauseWrites(ps.rootCauseWrites),
@@ -751,29 +753,81 @@ PersistentState::PersistentState(const PersistentState &ps)
     rootCauseFlushes(ps.rootCauseFlushes),
     pendingRootCauseFlushes(ps.pendingRootCauseFlushes),
 
+    persistedCacheLines(ps.persistedCacheLines),
+    noRootCauseWrites(ps.noRootCauseWrites),
+
     rootCauseWidth(ps.rootCauseWidth),
-    rootCauseMgr(ps.rootCauseMgr) {}
+    rootCauseMgr(ps.rootCauseMgr),
+
+    eventLog(ps.eventLog),
+    epoch(ps.epoch),
+
+    ignoreRanges(ps.ignoreRanges),
+    symbolicIgnoreRanges(ps.symbolicIgnoreRanges),
+
+    version(ps.version),
+    verdict(ps.verdict),
+
+    coalescingWrite(false) {}
+
+PersistentState::~PersistentState() {
+  releaseEventLog();
+}
 
 ObjectState *PersistentState::clone() const {
   return new PersistentState(*this);
 }
 
+void PersistentState::write(const ExecutionState &state,
+                            unsigned offset, ref<Expr> value) {
+  unsigned bytes = Expr::getMinBytesForWidth(value->getWidth());
+
+  // Bytes on the ignore list must not dirty their line, so fall back to 
+  // dirtying byte by byte.
+  if (coalescingWrite || mayOverlapIgnoreRange(offset, bytes)) {
+    ObjectState::write(state, offset, value);
+    return;
+  }
+
+  coalescingWrite = true;
+  ObjectState::write(state, offset, value);
+  coalescingWrite = false;
+
+  dirtyRange(state, offset, bytes);
+}
+
+void PersistentState::write(const ExecutionState &state,
+                            ref<Expr> offset, ref<Expr> value) {
+  // Constant offsets are coalesced by write(state, unsigned, value), which
+  // ObjectState::write dispatches to.
+  if (coalescingWrite || hasIgnoreRanges() || isa<ConstantExpr>(offset)) {
+    ObjectState::write(state, offset, value);
+    return;
+  }
+
+  coalescingWrite = true;
+  ObjectState::write(state, offset, value);
+  coalescingWrite = false;
+
+  dirtyRange(state, offset, Expr::getMinBytesForWidth(value->getWidth()));
+}
+
 void PersistentState::write8(const ExecutionState &state,
                              unsigned offset, uint8_t value) {
   ObjectState::write8(state, offset, value);
-  dirtyCacheLineAtOffset(state, offset);
+  if (!coalescingWrite) dirtyCacheLineAtOffset(state, offset);
 }
 
 void PersistentState::write8(const ExecutionState &state,
                              unsigned offset, ref<Expr> value) {
   ObjectState::write8(state, offset, value);
-  dirtyCacheLineAtOffset(state, offset);
+  if (!coalescingWrite) dirtyCacheLineAtOffset(state, offset);
 }
 
 void PersistentState::write8(const ExecutionState &state,
                              ref<Expr> offset, ref<Expr> value) {
   ObjectState::write8(state, offset, value);
-  dirtyCacheLineAtOffset(state, offset);
+  if (!coalescingWrite) dirtyCacheLineAtOffset(state, offset);
 }
 
 /* Used to avoid pushing duplicates onto update lists */
@@ -790,31 +844,144 @@ static bool isUpdateListHeadEqualTo(const UpdateList &updates,
 }
 
 void PersistentState::addIgnoreByte(ref<Expr> offset) {
-  ignoreBytes.push_back(offset);
+  addIgnoreRange(offset, 1);
 }
 
 void PersistentState::addIgnoreOffset(ref<Expr> offset, uint64_t width) {
-  for (uint64_t byte = 0; byte < (width / 8); ++byte) {
-    auto add = ConstantExpr::create(byte, offset->getWidth());
-    addIgnoreByte(AddExpr::create(offset, add));
-  }
+  addIgnoreRange(offset, width / 8);
 }
 
 void PersistentState::removeIgnoreByte(const ExecutionState &state, ref<Expr> offset) {
-  ref<Expr> back = ignoreBytes.back();
-  ignoreBytes.pop_back();
-
-  bool isEq;
-  assert(solver->mustBeTrue(state, EqExpr::create(back, offset), isEq));
-  assert(isEq && "did not remove in proper order!");
+  removeIgnoreRange(state, offset, 1);
 }
 
 void PersistentState::removeIgnoreOffset(const ExecutionState &state, ref<Expr> offset, uint64_t width) {
-  // Reverse order
-  for (uint64_t byte = (width / 8) - 1; byte >= 0; --byte) {
-    auto add = ConstantExpr::create(byte, offset->getWidth());
-    removeIgnoreByte(state, AddExpr::create(offset, add));
+  removeIgnoreRange(state, offset, width / 8);
+}
+
+void PersistentState::addIgnoreRange(ref<Expr> offset, uint64_t bytes) {
+  if (!bytes) return;
+
+  ConstantExpr *CE = dyn_cast<ConstantExpr>(offset);
+  if (!CE) {
+    // The same range tends to be added over and over (once per access).
+    for (auto &r : symbolicIgnoreRanges) {
+      if (r.second == bytes && !r.first.compare(offset)) return;
+    }
+    symbolicIgnoreRanges.emplace_back(offset, bytes);
+    return;
+  }
+
+  // Merge with every interval that overlaps or touches [start, end).
+  uint64_t start = CE->getZExtValue(), end = start + bytes;
+  auto it = ignoreRanges.upper_bound(start);
+  if (it != ignoreRanges.begin() && std::prev(it)->second >= start) {
+    --it;
+  }
+  while (it != ignoreRanges.end() && it->first <= end) {
+    start = std::min(start, it->first);
+    end = std::max(end, it->second);
+    it = ignoreRanges.erase(it);
+  }
+  ignoreRanges[start] = end;
+}
+
+void PersistentState::removeIgnoreRange(const ExecutionState &state,
+                                        ref<Expr> offset, uint64_t bytes) {
+  if (!bytes) return;
+
+  ConstantExpr *CE = dyn_cast<ConstantExpr>(offset);
+  if (!CE) {
+    for (auto it = symbolicIgnoreRanges.rbegin(), 
+              ie = symbolicIgnoreRanges.rend(); it != ie; ++it) {
+      if (it->second != bytes) continue;
+      bool isEq;
+      bool success = solver->mustBeTrue(state, 
+                                        EqExpr::create(it->first, offset), 
+                                        isEq);
+      assert(success && "FIXME: Unhandled solver failure");
+      if (isEq) {
+        symbolicIgnoreRanges.erase(std::next(it).base());
+        return;
+      }
+    }
+    assert(false && "removing a range that was never ignored!");
+    return;
+  }
+
+  // Cut [start, end) out of the intervals overlapping it.
+  uint64_t start = CE->getZExtValue(), end = start + bytes;
+  auto it = ignoreRanges.upper_bound(start);
+  if (it != ignoreRanges.begin() && std::prev(it)->second > start) {
+    --it;
   }
+  while (it != ignoreRanges.end() && it->first < end) {
+    uint64_t lo = it->first, hi = it->second;
+    it = ignoreRanges.erase(it);
+    if (lo < start) ignoreRanges[lo] = start;
+    if (hi > end) ignoreRanges[end] = hi;
+  }
+}
+
+bool PersistentState::isIgnoredOffset(const ExecutionState &state,
+                                      ref<Expr> offset) const {
+  if (!hasIgnoreRanges()) return false;
+
+  if (ConstantExpr *CE = dyn_cast<ConstantExpr>(offset)) {
+    uint64_t off = CE->getZExtValue();
+    auto it = ignoreRanges.upper_bound(off);
+    if (it != ignoreRanges.begin() && off < std::prev(it)->second) {
+      return true;
+    }
+    if (symbolicIgnoreRanges.empty()) return false;
+  }
+
+  // One query: does the offset have to fall in any of the ranges?
+  Expr::Width w = Context::get().getPointerWidth();
+  offset = ZExtExpr::create(offset, w);
+  ref<Expr> inRange = ConstantExpr::create(0, Expr::Bool);
+  for (auto &r : symbolicIgnoreRanges) {
+    ref<Expr> delta = SubExpr::create(offset, ZExtExpr::create(r.first, w));
+    inRange = OrExpr::create(inRange, 
+                             UltExpr::create(delta, 
+                                             ConstantExpr::create(r.second, w)));
+  }
+  if (!isa<ConstantExpr>(offset)) {
+    for (auto &r : ignoreRanges) {
+      ref<Expr> delta = SubExpr::create(offset, ConstantExpr::create(r.first, w));
+      inRange = OrExpr::create(inRange, 
+                               UltExpr::create(delta, 
+                                               ConstantExpr::create(r.second - r.first, w)));
+    }
+  }
+
+  bool isIgnored;
+  bool success = solver->mustBeTrue(state, inRange, isIgnored);
+  assert(success && "FIXME: Unhandled solver failure");
+  return isIgnored;
+}
+
+bool PersistentState::mayOverlapIgnoreRange(unsigned offset,
+                                            unsigned bytes) const {
+  if (!symbolicIgnoreRanges.empty()) return true;
+
+  auto it = ignoreRanges.lower_bound((uint64_t)offset + bytes);
+  return it != ignoreRanges.begin() && std::prev(it)->second > offset;
+}
+
+bool PersistentState::isIgnoredRange(const ExecutionState &state,
+                                     ref<Expr> offset, unsigned bytes) const {
+  if (!hasIgnoreRanges()) return false;
+  if (ConstantExpr *CE = dyn_cast<ConstantExpr>(offset)) {
+    if (!mayOverlapIgnoreRange(CE->getZExtValue(), bytes)) return false;
+  }
+
+  for (unsigned i = 0; i < bytes; ++i) {
+    ref<Expr> byte = AddExpr::create(
+        offset, ConstantExpr::create(i, offset->getWidth()));
+    if (!isIgnoredOffset(state, byte)) return false;
+  }
+  return true;
 }
 
 void PersistentState::dirtyCacheLineAtOffset(const ExecutionState &state,
@@ -824,58 +991,66 @@ void PersistentState::dirtyCacheLineAtOffset(const ExecutionState &state,
 
 void PersistentState::dirtyCacheLineAtOffset(const ExecutionState &state,
                                              ref<Expr> offset) {
+  if (!PersistencyModel::get().tracksWrites()) return;
+
   // First, we check if we should be ignoring this offset.
-  for (ref<Expr> o : ignoreBytes) {
-    ref<Expr> eq = EqExpr::create(o, 
-                    ZExtExpr::create(offset, Context::get().getPointerWidth()));
-    bool isEq;
-    assert(solver->mustBeTrue(state, eq, isEq));
-    if (isEq) {
-      klee_warning_once(offset.get(), "Ignoring dirty-ing the byte!");
-      return;
-    }
+  if (isIgnoredOffset(state, offset)) {
+    klee_warning_once(offset.get(), "Ignoring dirty-ing the byte!");
+    return;
   }
 
+  ++version;
+  createTrackingArrays();
+
   // Apply the dirty to the authoritative update list as well as the pending one
   // (so that we can properly identify unpersisted lines in the middle of an epoch).
   ref<Expr> cacheLine = getCacheLine(offset);
   ref<Expr> falseExpr = getDirtyExpr();
-  
-  /**
-   * We also want to see if this cache line is currently dirty. If so, we have
-   * to create an extended root cause.
-   */
-  auto idx = getAnyOffsetExpr();
-  auto inBoundsConstraint = getObject()->getBoundsCheckOffset(idx);
-
-  state.constraints.addConstraint(inBoundsConstraint);
-  // We actually want this to be pending, because sandwiching a flush between
-  // two stores to the same offset technically flushes it
-  // Also, this takes a cache line...
-  auto prevWrites = getRootCause(state, pendingRootCauseWrites, cacheLine);
-  state.constraints.removeConstraint(inBoundsConstraint);
-
-  // Now update root cause.
-  ref<Expr> rootCauseExpr = createRootCauseIdExpr(state, PM_Unpersisted, prevWrites);
-
-  // iangneal: problems with root cause tracking
-  if (!isUpdateListHeadEqualTo(pendingCacheLineUpdates, cacheLine, falseExpr)) {
-    cacheLineUpdates.extend(cacheLine, falseExpr);
-    pendingCacheLineUpdates.extend(cacheLine, falseExpr);
-
-    // rootCauseWrites.extend(cacheLine, rootCauseExpr);
-    // pendingRootCauseWrites.extend(cacheLine, rootCauseExpr);
+
+  if (!symbolicTracking && isa<ConstantExpr>(cacheLine)) {
+    // Concrete fast path, no update nodes needed.
+    unsigned cl = cast<ConstantExpr>(cacheLine)->getZExtValue();
+    assert(cl < numCacheLines() && "dirtying cache line out of bounds!");
+    dirtyLines.insert(cl);
+    pendingDirtyLines.insert(cl);
   } else {
-    // iangneal: just replace the head
-    // rootCauseWrites.pop();
-    // pendingRootCauseWrites.pop();
+    enableSymbolicTracking();
 
-    // rootCauseWrites.extend(cacheLine, rootCauseExpr);
-    // pendingRootCauseWrites.extend(cacheLine, rootCauseExpr);
+    // iangneal: problems with root cause tracking
+    if (!isUpdateListHeadEqualTo(pendingCacheLineUpdates, cacheLine, falseExpr)) {
+      cacheLineUpdates.extend(cacheLine, falseExpr);
+      pendingCacheLineUpdates.extend(cacheLine, falseExpr);
+    }
   }
 
-  rootCauseWrites.extend(cacheLine, rootCauseExpr);
-  pendingRootCauseWrites.extend(cacheLine, rootCauseExpr);
+  if (DeferRootCauses) {
+    logPersistEvent(state, PersistEvent::Write, cacheLine);
+  } else {
+    /**
+     * We also want to see if this cache line is currently dirty. If so, we 
+     * have to create an extended root cause.
+     */
+    auto idx = getAnyOffsetExpr();
+    auto inBoundsConstraint = getObject()->getBoundsCheckOffset(idx);
+
+    state.constraints.addConstraint(inBoundsConstraint);
+    // We actually want this to be pending, because sandwiching a flush 
+    // between two stores to the same offset technically flushes it
+    // Also, this takes a cache line...
+    auto prevWrites = getRootCause(state, pendingRootCauseWrites, cacheLine);
+    state.constraints.removeConstraint(inBoundsConstraint);
+
+    // Now update root cause.
+    ref<Expr> rootCauseExpr = createRootCauseIdExpr(state, PM_Unpersisted, 
+                                                    prevWrites);
+
+    rootCauseWrites.extend(cacheLine, rootCauseExpr);
+    pendingRootCauseWrites.extend(cacheLine, rootCauseExpr);
+  }
+
+  if (PersistencyModel::get().fencePersistsWrites()) {
+    flushWrittenLines(state, {cacheLine});
+  }
 }
 
 void PersistentState::persistCacheLineAtOffset(const ExecutionState &state, 
@@ -887,23 +1062,214 @@ void PersistentState::persistCacheLineAtOffset(const ExecutionState &state,
                                                ref<Expr> offset) {
   /* llvm::errs() << getObject()->name << ":\n"; */
   /* ExprPPrinter::printOne(llvm::errs(), "persistCacheLineAtOffset", offset); */
+  persistRange(state, offset, 1);
+}
+
+/**
+ * Each update writes either its new value or the line's current one, so
+ * the lists stay one node per flush. In the event log, a flush that misses
+ * goes to a line past the end of the object, which no write ever matches.
+ */
+void PersistentState::persistCacheLineAtOffset(const ExecutionState &state,
+                                               ref<Expr> offset,
+                                               ref<Expr> condition) {
+  if (ConstantExpr *CE = dyn_cast<ConstantExpr>(condition)) {
+    if (CE->isTrue()) persistRange(state, offset, 1);
+    return;
+  }
+
+  ++version;
+  createTrackingArrays();
+  enableSymbolicTracking();
+
   ref<Expr> cacheLine = getCacheLine(offset);
-  pendingCacheLineUpdates.extend(cacheLine, getPersistedExpr());
+  auto conditionally = [&](const UpdateList &ul, ref<Expr> value) {
+    return SelectExpr::create(condition, value, ReadExpr::create(ul, cacheLine));
+  };
+
+  pendingCacheLineUpdates.extend(
+      cacheLine, conditionally(pendingCacheLineUpdates, getPersistedExpr()));
+
+  if (DeferRootCauses) {
+    ref<Expr> noLine = ConstantExpr::create(numCacheLines(), Expr::Int32);
+    logPersistEvent(state, PersistEvent::Flush,
+                    SelectExpr::create(condition, cacheLine, noLine));
+    return;
+  }
+
+  ref<Expr> rootCauseExpr = createRootCauseIdExpr(state, PM_UnnecessaryFlush);
+  rootCauseFlushes.extend(
+      cacheLine, conditionally(rootCauseFlushes, rootCauseExpr));
+  pendingRootCauseFlushes.extend(
+      cacheLine, conditionally(pendingRootCauseFlushes, rootCauseExpr));
+  pendingRootCauseWrites.extend(
+      cacheLine, conditionally(pendingRootCauseWrites, getNullptr()));
+}
+
+void PersistentState::dirtyRange(const ExecutionState &state,
+                                 unsigned offset, unsigned size) {
+  dirtyRange(state, ConstantExpr::create(offset, Expr::Int32), size);
+}
+
+void PersistentState::dirtyRange(const ExecutionState &state,
+                                 ref<Expr> offset, unsigned size) {
+  if (!size || !PersistencyModel::get().tracksWrites()) return;
+  offset = ZExtExpr::create(offset, Expr::Int32);
+
+  // Ignored bytes must not dirty their line, so leave ranges that may
+  // contain some to the byte-by-byte path.
+  bool mayIgnore;
+  if (ConstantExpr *CE = dyn_cast<ConstantExpr>(offset)) {
+    mayIgnore = mayOverlapIgnoreRange(CE->getZExtValue(), size);
+  } else {
+    mayIgnore = hasIgnoreRanges();
+  }
+  if (mayIgnore) {
+    for (unsigned i = 0; i < size; ++i) {
+      dirtyCacheLineAtOffset(state, 
+          AddExpr::create(offset, ConstantExpr::create(i, Expr::Int32)));
+    }
+    return;
+  }
+
+  ++version;
+  createTrackingArrays();
 
-  // llvm::errs() << getObject()->address << ": persist: " << *offset << "\n";
-  // llvm::errs() << "\t" << getLocationInfo(state, cacheLine, "test") << "\n";
+  std::vector<ref<Expr> > cacheLines = getCacheLinesInRange(offset, size);
+  ref<Expr> falseExpr = getDirtyExpr();
+
+  if (!symbolicTracking && isa<ConstantExpr>(offset)) {
+    for (const ref<Expr> &cacheLine : cacheLines) {
+      unsigned cl = cast<ConstantExpr>(cacheLine)->getZExtValue();
+      assert(cl < numCacheLines() && "dirtying cache line out of bounds!");
+      dirtyLines.insert(cl);
+      pendingDirtyLines.insert(cl);
+    }
+  } else {
+    enableSymbolicTracking();
+    for (const ref<Expr> &cacheLine : cacheLines) {
+      if (!isUpdateListHeadEqualTo(pendingCacheLineUpdates, cacheLine, falseExpr)) {
+        cacheLineUpdates.extend(cacheLine, falseExpr);
+        pendingCacheLineUpdates.extend(cacheLine, falseExpr);
+      }
+    }
+  }
+
+  if (DeferRootCauses) {
+    for (const ref<Expr> &cacheLine : cacheLines) {
+      logPersistEvent(state, PersistEvent::Write, cacheLine);
+    }
+  } else {
+    // The span masks the unflushed writes to any of its lines.
+    auto prevWrites = getRootCauseInRange(state, pendingRootCauseWrites, 
+                                          offset, size);
+    ref<Expr> rootCauseExpr = createRootCauseIdExpr(state, PM_Unpersisted, 
+                                                    prevWrites);
+
+    for (const ref<Expr> &cacheLine : cacheLines) {
+      rootCauseWrites.extend(cacheLine, rootCauseExpr);
+      pendingRootCauseWrites.extend(cacheLine, rootCauseExpr);
+    }
+  }
+
+  if (PersistencyModel::get().fencePersistsWrites()) {
+    flushWrittenLines(state, cacheLines);
+  }
+}
+
+/**
+ * A flush of lines that were just dirtied, for models where the next fence
+ * persists writes by itself. Unlike persistRange, this does not create a 
+ * root cause of its own: it is never an unnecessary flush.
+ */
+void PersistentState::flushWrittenLines(const ExecutionState &state,
+                                        const std::vector<ref<Expr> > &cacheLines) {
+  for (const ref<Expr> &cacheLine : cacheLines) {
+    if (!symbolicTracking) {
+      unsigned cl = cast<ConstantExpr>(cacheLine)->getZExtValue();
+      pendingDirtyLines.erase(cl);
+      epochFlushedLines.push_back(cl);
+    } else {
+      pendingCacheLineUpdates.extend(cacheLine, getPersistedExpr());
+    }
+
+    if (DeferRootCauses) {
+      logPersistEvent(state, PersistEvent::Flush, cacheLine);
+    } else {
+      pendingRootCauseWrites.extend(cacheLine, getNullptr());
+    }
+  }
+}
+
+void PersistentState::persistRange(const ExecutionState &state,
+                                   unsigned offset, unsigned size) {
+  persistRange(state, ConstantExpr::create(offset, Expr::Int32), size);
+}
+
+void PersistentState::persistRange(const ExecutionState &state,
+                                   ref<Expr> offset, unsigned size) {
+  if (!size) return;
+
+  ++version;
+  createTrackingArrays();
+
+  std::vector<ref<Expr> > cacheLines = getCacheLinesInRange(offset, size);
+  if (!symbolicTracking && isa<ConstantExpr>(cacheLines.front())) {
+    for (const ref<Expr> &cacheLine : cacheLines) {
+      unsigned cl = cast<ConstantExpr>(cacheLine)->getZExtValue();
+      assert(cl < numCacheLines() && "flushing cache line out of bounds!");
+      pendingDirtyLines.erase(cl);
+      epochFlushedLines.push_back(cl);
+    }
+  } else {
+    enableSymbolicTracking();
+    for (const ref<Expr> &cacheLine : cacheLines) {
+      pendingCacheLineUpdates.extend(cacheLine, getPersistedExpr());
+    }
+  }
+
+  if (DeferRootCauses) {
+    for (const ref<Expr> &cacheLine : cacheLines) {
+      logPersistEvent(state, PersistEvent::Flush, cacheLine);
+    }
+    return;
+  }
 
   ref<Expr> rootCauseExpr = createRootCauseIdExpr(state, PM_UnnecessaryFlush);
-  rootCauseFlushes.extend(cacheLine, rootCauseExpr);
-  pendingRootCauseFlushes.extend(cacheLine, rootCauseExpr);
-  // Pending clear
-  pendingRootCauseWrites.extend(cacheLine, getNullptr());
+  for (const ref<Expr> &cacheLine : cacheLines) {
+    rootCauseFlushes.extend(cacheLine, rootCauseExpr);
+    pendingRootCauseFlushes.extend(cacheLine, rootCauseExpr);
+    // Pending clear
+    pendingRootCauseWrites.extend(cacheLine, getNullptr());
+  }
 }
 
 bool PersistentState::commitPendingPersists(const ExecutionState &state) {
   /* llvm::errs() << getObject()->name << ": "; */
   /* llvm::errs() << "commitPendingPersists\n"; */
 
+  ++epoch;
+  ++version;
+
+  if (!symbolicTracking) {
+    // Only flushed lines can differ between the two views.
+    bool commitNecessary = !epochFlushedLines.empty();
+    for (unsigned cl : epochFlushedLines) {
+      if (pendingDirtyLines.count(cl)) {
+        dirtyLines.insert(cl);
+      } else {
+        dirtyLines.erase(cl);
+      }
+    }
+    epochFlushedLines.clear();
+
+    rootCauseWrites = pendingRootCauseWrites;
+    pendingRootCauseFlushes = UpdateList(pendingRootCauseFlushes.root, nullptr);
+    compactUpdateLists();
+
+    return commitNecessary;
+  }
+
   size_t prevSz = cacheLineUpdates.getSize();
 
   // Apply the writes and flushes accumulated during this epoch.
@@ -913,7 +1279,90 @@ bool PersistentState::commitPendingPersists(const ExecutionState &state) {
   // clear
   pendingRootCauseFlushes = UpdateList(pendingRootCauseFlushes.root, nullptr);
 
-  return prevSz != cacheLineUpdates.getSize();
+  bool commitNecessary = prevSz != cacheLineUpdates.getSize();
+  compactUpdateLists();
+
+  return commitNecessary;
+}
+
+/**
+ * Right after a commit, the committed and pending lists are the same, so
+ * compacting the committed ones and resetting the pending ones to them
+ * loses nothing.
+ */
+void PersistentState::compactUpdateLists() {
+  if (!CompactPmemUpdates) return;
+
+  cacheLineUpdates = compactUpdateList(cacheLineUpdates);
+  pendingCacheLineUpdates = cacheLineUpdates;
+  rootCauseWrites = compactUpdateList(rootCauseWrites);
+  pendingRootCauseWrites = rootCauseWrites;
+  rootCauseFlushes = compactUpdateList(rootCauseFlushes);
+}
+
+/**
+ * Fold the oldest run of concrete updates into a new constant array, like
+ * ObjectState::getUpdates does for object contents. Only the updates from
+ * the first symbolic one onwards are kept as update nodes.
+ */
+UpdateList PersistentState::compactUpdateList(const UpdateList &ul) const {
+  if (!ul.root || !ul.root->isConstantArray() || 
+      ul.getSize() < CompactPmemUpdates) {
+    return ul;
+  }
+
+  // Collect the list of updates, with the oldest updates first.
+  unsigned NumWrites = ul.getSize();
+  std::vector< std::pair< ref<Expr>, ref<Expr> > > Writes(NumWrites);
+  const UpdateNode *un = ul.head;
+  for (unsigned i = NumWrites; i != 0; un = un->next) {
+    --i;
+    Writes[i] = std::make_pair(un->index, un->value);
+  }
+
+  unsigned Begin = 0, End = Writes.size();
+  for (; Begin != End; ++Begin) {
+    if (!isa<ConstantExpr>(Writes[Begin].first) ||
+        !isa<ConstantExpr>(Writes[Begin].second))
+      break;
+  }
+
+  if (Begin < CompactPmemUpdates) return ul;
+
+  std::vector< ref<ConstantExpr> > Contents(ul.root->constantValues);
+  for (unsigned i = 0; i != Begin; ++i) {
+    uint64_t idx = cast<ConstantExpr>(Writes[i].first)->getZExtValue();
+    assert(idx < Contents.size() && "update out of bounds!");
+    Contents[idx] = cast<ConstantExpr>(Writes[i].second);
+  }
+
+  // A compacted list is compacted again later, so the name is built from
+  // the name of the original array rather than growing each time.
+  static const std::string snapSuffix = "_snap";
+  std::string baseName = ul.root->name;
+  size_t snapPos = baseName.rfind(snapSuffix);
+  if (snapPos != std::string::npos &&
+      snapPos + snapSuffix.size() < baseName.size() &&
+      baseName.find_first_not_of("0123456789",
+                                 snapPos + snapSuffix.size()) ==
+          std::string::npos) {
+    baseName.erase(snapPos);
+  }
+
+  static unsigned id = 0;
+  // The contents often recur, e.g. in the states forked from one another,
+  // which then share one array.
+  const Array *array = getArrayCache()->CreateSharedConstantArray(
+      baseName + snapSuffix + llvm::utostr(++id), ul.root->size,
+      &Contents[0], &Contents[0] + Contents.size(),
+      ul.root->domain, ul.root->range);
+  UpdateList compacted(array, nullptr);
+
+  // Apply the remaining (non-constant) updates.
+  for (; Begin != End; ++Begin)
+    compacted.extend(Writes[Begin].first, Writes[Begin].second);
+
+  return compacted;
 }
 
 ref<Expr> PersistentState::getIsOffsetPersistedExpr(ref<Expr> offset,
@@ -936,9 +1385,16 @@ void PersistentState::clearRootCauses() {
 uint64_t 
 PersistentState::markFlushAsBug(ExecutionState &state, 
                                 ref<Expr> offset) const {
-  auto errs = getRootCause(state, rootCauseFlushes, getCacheLine(offset)); 
+  bool flushedBefore;
+  if (DeferRootCauses) {
+    flushedBefore = mayHaveBeenFlushed(state, getCacheLine(offset));
+  } else {
+    flushedBefore = !getRootCause(state, rootCauseFlushes, 
+                                  getCacheLine(offset)).empty();
+  }
+
   uint64_t id; 
-  if (errs.empty()) {
+  if (!flushedBefore) {
     id = rootCauseMgr->getRootCauseLocationID(state, 
                                               getObject()->allocSite,
                                               state.prevPC(),
@@ -956,12 +1412,75 @@ PersistentState::markFlushAsBug(ExecutionState &state,
   return id;
 }
 
+void PersistentState::getUnpersistedCacheLines(
+    std::vector<unsigned> &dirty,
+    std::vector<std::pair<unsigned, ref<Expr> > > &maybeDirty) const {
+  if (!symbolicTracking) {
+    dirty.insert(dirty.end(), dirtyLines.begin(), dirtyLines.end());
+    return;
+  }
+
+  if (cacheLineUpdates.head == nullptr) return;
+
+  // Reading a constant line folds through the update list up to the first
+  // symbolic index, so most lines are decided here.
+  for (unsigned cl = 0; cl < numCacheLines(); ++cl) {
+    ref<Expr> persisted = isCacheLinePersisted(cl);
+    if (ConstantExpr *CE = dyn_cast<ConstantExpr>(persisted)) {
+      if (CE->isFalse()) dirty.push_back(cl);
+      continue;
+    }
+    maybeDirty.emplace_back(cl, Expr::createIsZero(persisted));
+  }
+}
+
+bool PersistentState::getCachedPersistenceVerdict(
+    const ExecutionState &state, 
+    std::unordered_set<uint64_t> &rootCauses) const {
+  if (!verdict || verdict->version != version) return false;
+
+  if (verdict->dependsOnConstraints) {
+    // More constraints only rule out models, so a persisted object stays
+    // persisted in descendants of the state the check was made in. Root
+    // causes may differ though, so those need the very same constraints.
+    bool holds = verdict->rootCauses.empty()
+      ? verdict->constraints.isSubsetOf(state.constraints)
+      : verdict->constraints == state.constraints;
+    if (!holds) return false;
+  }
+
+  rootCauses = verdict->rootCauses;
+  return true;
+}
+
+void PersistentState::cachePersistenceVerdict(
+    const ExecutionState &state,
+    const std::unordered_set<uint64_t> &rootCauses) const {
+  auto v = std::make_shared<PersistenceVerdict>();
+  v->version = version;
+  // Without symbolic tracking, every line and root cause is a constant.
+  v->dependsOnConstraints = symbolicTracking;
+  if (symbolicTracking) v->constraints = state.constraints;
+  v->rootCauses = rootCauses;
+  verdict = v;
+}
+
 /**
- * Get all the unflushed writes remaining.
+ * Get the unflushed writes remaining in the given cache lines.
  */
 std::unordered_set<uint64_t> 
-PersistentState::markNonPersistedWritesAsBugs(ExecutionState &state) const {
-  auto errs = getRootCauses(state, rootCauseWrites);
+PersistentState::markNonPersistedWritesAsBugs(
+    ExecutionState &state, const std::vector<unsigned> &lines) const {
+  std::unordered_set<uint64_t> errs;
+  for (unsigned cl : lines) {
+    auto ids = DeferRootCauses 
+      ? getDeferredRootCause(state, ConstantExpr::create(cl, Expr::Int32), false)
+      : getRootCause(state, rootCauseWrites, cl);
+    for (auto id : ids) {
+      assert(id > 0);
+      errs.insert(id);
+    }
+  }
   assert(errs.size() && 
          "we called mark as bugs for writes without there being any bugs!");
 
@@ -972,34 +1491,6 @@ PersistentState::markNonPersistedWritesAsBugs(ExecutionState &state) const {
   return errs;
 }
 
-std::unordered_set<uint64_t>
-PersistentState::getRootCauses(ExecutionState &state,
-                               const UpdateList &ul) const {
-  std::unordered_set<uint64_t> causes;
-  if (ul.head == nullptr) {
-    return causes;
-  }
-
-  // auto idx = getAnyOffsetExpr();
-  // auto inBoundsConstraint = getObject()->getBoundsCheckOffset(idx);
-
-  // state.constraints.addConstraint(inBoundsConstraint);
-  // causes = getRootCause(state, ul, getCacheLine(idx));
-  // state.constraints.removeConstraint(inBoundsConstraint);
-  for (uint64_t cl = 0; cl < numCacheLines(); ++cl) {
-    bool res;
-    assert(solver->mustBeTrue(state, isCacheLinePersisted(cl), res));
-    if (res) continue;
-    
-    for (auto id : getRootCause(state, rootCauseWrites, cl)) {
-      assert(id > 0);
-      causes.insert(id);
-    }
-  }
-  
-  return causes;
-}
-
 ref<Expr> PersistentState::isCacheLinePersisted(unsigned cacheLine,
                                                 bool pending) const {
   return isCacheLinePersisted(ConstantExpr::create(cacheLine, Expr::Int32),
@@ -1009,6 +1500,23 @@ ref<Expr> PersistentState::isCacheLinePersisted(unsigned cacheLine,
 ref<Expr> PersistentState::isCacheLinePersisted(ref<Expr> cacheLine,
                                                 bool pending) const {
   // llvm::errs() << "isCacheLinePersisted: " << *cacheLine << "\n";
+  if (!symbolicTracking) {
+    if (ConstantExpr *CE = dyn_cast<ConstantExpr>(cacheLine)) {
+      unsigned cl = CE->getZExtValue();
+      assert(cl < numCacheLines() && "querying cache line out of bounds!");
+      bool dirty = pending ? pendingDirtyLines.count(cl) : dirtyLines.count(cl);
+      return ConstantExpr::create(!dirty, Expr::Bool);
+    }
+
+    UpdateList updateList = getConcreteCacheLineUpdates(pending);
+    if (updateList.head == nullptr) {
+      return ConstantExpr::create(1, Expr::Bool);
+    }
+    ref<Expr> result = ReadExpr::create(updateList,
+                                        ZExtExpr::create(cacheLine, Expr::Int32));
+    return EqExpr::create(result, getPersistedExpr());
+  }
+
   auto &updateList = pending ? pendingCacheLineUpdates : cacheLineUpdates;
 
   // If no updates, then trivially persisted
@@ -1022,6 +1530,38 @@ ref<Expr> PersistentState::isCacheLinePersisted(ref<Expr> cacheLine,
   return EqExpr::create(result, getPersistedExpr());
 }
 
+UpdateList PersistentState::getConcreteCacheLineUpdates(bool pending) const {
+  UpdateList updates(cacheLineUpdates.root, nullptr);
+  for (unsigned cl : dirtyLines) {
+    updates.extend(ConstantExpr::create(cl, Expr::Int32), getDirtyExpr());
+  }
+
+  if (pending) {
+    // Replay this epoch's flushes; a write after the flush leaves the line
+    // dirty again.
+    for (unsigned cl : epochFlushedLines) {
+      updates.extend(ConstantExpr::create(cl, Expr::Int32),
+                     pendingDirtyLines.count(cl) ? getDirtyExpr() 
+                                                 : getPersistedExpr());
+    }
+  }
+
+  return updates;
+}
+
+void PersistentState::enableSymbolicTracking() {
+  if (symbolicTracking) return;
+
+  createTrackingArrays();
+  cacheLineUpdates = getConcreteCacheLineUpdates(false);
+  pendingCacheLineUpdates = getConcreteCacheLineUpdates(true);
+  symbolicTracking = true;
+
+  dirtyLines.clear();
+  pendingDirtyLines.clear();
+  epochFlushedLines.clear();
+}
+
 std::unordered_set<uint64_t> 
 PersistentState::getRootCause(const ExecutionState &state,
                               const UpdateList &ul,
@@ -1034,44 +1574,171 @@ std::unordered_set<uint64_t>
 PersistentState::getRootCause(const ExecutionState &state,
                               const UpdateList &ul,
                               ref<Expr> cacheLine) const {
+  std::unordered_set<uint64_t> possibleCauses;
+  // Nothing was ever dirtied or flushed here.
+  if (!ul.root) return possibleCauses;
+
   ref<Expr> result = ReadExpr::create(ul, ZExtExpr::create(cacheLine, Expr::Int32));
-  
+
+  // 0 represents no root cause.
+  std::vector<ref<ConstantExpr> > ids;
+  bool success = solver->getValues(state, result, ids,
+                                   ConstantExpr::create(0, rootCauseWidth));
+  assert(success && "FIXME: Unhandled solver failure");
+
+  for (auto &id : ids) {
+    possibleCauses.insert(id->getZExtValue());
+  }
+
+  return possibleCauses;
+}
+
+/**
+ * While every update is at a concrete line, reading each line folds to a
+ * constant. Otherwise, a single query over a symbolic offset constrained to
+ * the range replaces one query per cache line.
+ */
+std::unordered_set<uint64_t>
+PersistentState::getRootCauseInRange(const ExecutionState &state,
+                                     const UpdateList &ul,
+                                     ref<Expr> offset,
+                                     unsigned size) const {
   std::unordered_set<uint64_t> possibleCauses;
+  if (!ul.root) return possibleCauses;
+
+  if (isa<ConstantExpr>(offset)) {
+    std::vector<ref<Expr> > cacheLines = getCacheLinesInRange(offset, size);
+    if (!symbolicTracking || cacheLines.size() == 1) {
+      for (const ref<Expr> &cacheLine : cacheLines) {
+        auto causes = getRootCause(state, ul, cacheLine);
+        possibleCauses.insert(causes.begin(), causes.end());
+      }
+      return possibleCauses;
+    }
+  }
 
-  std::pair<ref<Expr>, ref<Expr> > range = solver->getRange(state, result);
-
-  ref<ConstantExpr> lo = dyn_cast<ConstantExpr>(range.first);
-  ref<ConstantExpr> hi = dyn_cast<ConstantExpr>(range.second);  
-  assert(!lo.isNull() && !hi.isNull() && "FIXME: unhandled solver failure");
-
-  // This is a little jank, but 0 represents no root cause.
-  // If both are 0, there are no root causes.
-  // If the lower bound is 0, that means there's a version of life where this
-  // has no root cause. Skip it.
-  uint64_t loVal = lo->getZExtValue();
-  uint64_t hiVal = hi->getZExtValue();
-  if (loVal == 0 && hiVal == 0) return possibleCauses;
-  if (loVal == 0) loVal++;
-  assert(loVal <= hiVal);
-
-  if (loVal == hiVal) {
-    uint64_t id = loVal;
-    possibleCauses.insert(id);
-  } else {
-    for (uint64_t id = loVal; id <= hiVal; ++id) {
-      ref<Expr> eqId = EqExpr::create(ConstantExpr::create(id, rootCauseWidth),
-                                      result);
-      bool mayBeCause = false;
-      bool success = solver->mayBeTrue(state, eqId, mayBeCause);
-      assert(success);
-      if (!mayBeCause) continue;
-      possibleCauses.insert(id);
+  Expr::Width width = Context::get().getPointerWidth();
+  ref<Expr> idx = getAnyOffsetExpr();
+  ref<Expr> begin = ZExtExpr::create(offset, width);
+  ref<Expr> end = AddExpr::create(begin, ConstantExpr::create(size, width));
+
+  // Restore the constraints wholesale, the manager may split or rewrite
+  // what we add.
+  ConstraintManager saved(state.constraints);
+  state.constraints.addConstraint(getObject()->getBoundsCheckOffset(idx));
+  state.constraints.addConstraint(UgeExpr::create(idx, begin));
+  state.constraints.addConstraint(UltExpr::create(idx, end));
+  possibleCauses = getRootCause(state, ul, getCacheLine(idx));
+  state.constraints = saved;
+
+  return possibleCauses;
+}
+
+void PersistentState::logPersistEvent(const ExecutionState &state,
+                                      PersistEvent::Kind kind,
+                                      ref<Expr> cacheLine) {
+  eventLog = std::make_shared<const PersistEvent>(
+      kind, cacheLine, state.prevPC(), rootCauseMgr->getCallStack(state),
+      epoch, eventLog);
+}
+
+/**
+ * Walk the log from the newest event backwards. Every write that may be to 
+ * the cache line is a possible root cause, until we find a write or a 
+ * (committed) flush that must be to the cache line. Each root cause masks the
+ * older writes to the same line that were not flushed in between, which is 
+ * what dirtyCacheLineAtOffset computes eagerly in the non-deferred mode.
+ */
+std::unordered_set<uint64_t> 
+PersistentState::getDeferredRootCause(const ExecutionState &state,
+                                      ref<Expr> cacheLine,
+                                      bool pending) const {
+  std::unordered_set<uint64_t> possibleCauses;
+
+  auto mayBeLine = [&](const PersistEvent *ev, bool &mustBe) {
+    ref<Expr> eq = EqExpr::create(ZExtExpr::create(ev->cacheLine, Expr::Int32),
+                                  ZExtExpr::create(cacheLine, Expr::Int32));
+    bool success = solver->mustBeTrue(state, eq, mustBe);
+    assert(success && "FIXME: Unhandled solver failure");
+    if (mustBe) return true;
+
+    bool mayBe;
+    success = solver->mayBeTrue(state, eq, mayBe);
+    assert(success && "FIXME: Unhandled solver failure");
+    return mayBe;
+  };
+
+  for (const PersistEvent *ev = eventLog.get(); ev; ev = ev->prev.get()) {
+    if (ev->kind == PersistEvent::Flush && !pending && ev->epoch == epoch) {
+      // Not committed yet.
+      continue;
+    }
+
+    bool mustBe;
+    if (!mayBeLine(ev, mustBe)) continue;
+
+    if (ev->kind == PersistEvent::Flush) {
+      if (mustBe) break;
+      continue;
+    }
+
+    // Collect the writes this one masks, oldest first, so they are known to
+    // the root cause manager before we are.
+    std::vector<const PersistEvent*> masked;
+    for (const PersistEvent *older = ev->prev.get(); older; 
+         older = older->prev.get()) {
+      bool olderMustBe;
+      if (!mayBeLine(older, olderMustBe)) continue;
+      if (older->kind == PersistEvent::Flush) {
+        if (olderMustBe) break;
+        continue;
+      }
+      masked.push_back(older);
+    }
+
+    std::unordered_set<uint64_t> maskedIds;
+    for (auto it = masked.rbegin(); it != masked.rend(); ++it) {
+      maskedIds.insert(rootCauseMgr->getDeferredRootCauseLocationID(
+          state, (*it)->callStack, getObject()->allocSite, (*it)->inst,
+          PM_Unpersisted, std::unordered_set<uint64_t>()));
     }
+
+    possibleCauses.insert(rootCauseMgr->getDeferredRootCauseLocationID(
+        state, ev->callStack, getObject()->allocSite, ev->inst,
+        PM_Unpersisted, maskedIds));
+
+    if (mustBe) break;
   }
 
   return possibleCauses;
 }
 
+void PersistentState::releaseEventLog() {
+  // Release the log iteratively; letting the shared_ptr chain destroy itself
+  // recursively overflows the stack on long logs.
+  while (eventLog && eventLog.use_count() == 1) {
+    std::shared_ptr<const PersistEvent> prev = eventLog->prev;
+    eventLog = prev;
+  }
+  eventLog.reset();
+}
+
+bool PersistentState::mayHaveBeenFlushed(const ExecutionState &state,
+                                         ref<Expr> cacheLine) const {
+  for (const PersistEvent *ev = eventLog.get(); ev; ev = ev->prev.get()) {
+    if (ev->kind != PersistEvent::Flush) continue;
+
+    ref<Expr> eq = EqExpr::create(ZExtExpr::create(ev->cacheLine, Expr::Int32),
+                                  ZExtExpr::create(cacheLine, Expr::Int32));
+    bool mayBe;
+    bool success = solver->mayBeTrue(state, eq, mayBe);
+    assert(success && "FIXME: Unhandled solver failure");
+    if (mayBe) return true;
+  }
+
+  return false;
+}
+
 ref<Expr> PersistentState::getCacheLine(ref<Expr> offset) const {
   auto cacheLineSizeExpr = ConstantExpr::create(cacheLineSize(), offset->getWidth());
   auto cacheLineOffset = UDivExpr::create(offset, cacheLineSizeExpr);
@@ -1082,6 +1749,49 @@ ref<Expr> PersistentState::getCacheLine(ref<Expr> offset) const {
   return truncToIdxSz;
 }
 
+/**
+ * The line of every cacheLineSize()-th byte and of the last byte. With a
+ * symbolic offset, the last byte may share the line of the one before it,
+ * which only costs a redundant update.
+ */
+std::vector<ref<Expr> > 
+PersistentState::getCacheLinesInRange(ref<Expr> offset, unsigned size) const {
+  std::vector<ref<Expr> > cacheLines;
+  if (!size) return cacheLines;
+
+  offset = ZExtExpr::create(offset, Expr::Int32);
+  unsigned lineSz = cacheLineSize();
+
+  if (ConstantExpr *CE = dyn_cast<ConstantExpr>(offset)) {
+    uint64_t first = CE->getZExtValue() / lineSz;
+    uint64_t last = (CE->getZExtValue() + size - 1) / lineSz;
+    for (uint64_t cl = first; cl <= last; ++cl) {
+      cacheLines.push_back(ConstantExpr::create(cl, Expr::Int32));
+    }
+    return cacheLines;
+  }
+
+  cacheLines.push_back(getCacheLine(offset));
+  if (size == 1) return cacheLines;
+
+  // Any line strictly inside a range wider than a cache line.
+  for (unsigned i = lineSz; i < size - 1; i += lineSz) {
+    cacheLines.push_back(getCacheLine(
+        AddExpr::create(offset, ConstantExpr::create(i, Expr::Int32))));
+  }
+
+  // The last byte may spill over into the next cache line.
+  ref<Expr> lastLine = getCacheLine(
+      AddExpr::create(offset, ConstantExpr::create(size - 1, Expr::Int32)));
+  ConstantExpr *CE = dyn_cast<ConstantExpr>(
+      EqExpr::create(cacheLines.front(), lastLine));
+  if (!CE || CE->isFalse()) {
+    cacheLines.push_back(lastLine);
+  }
+
+  return cacheLines;
+}
+
 unsigned PersistentState::numCacheLines() const {
   return getObject()->parent->getSizeInCacheLines(size);
 }
@@ -1136,6 +1846,50 @@ PersistentState::createRootCauseIdExpr(const ExecutionState &state,
   return ConstantExpr::create(id, rootCauseWidth);                               
 }
 
+void PersistentState::createTrackingArrays() {
+  if (cacheLineUpdates.root) return;
+
+  // Set up all the symbolic Arrays we need.
+  ArrayCache *arrayCache = getArrayCache();
+  const MemoryObject *object = getObject();
+  uint64_t size = numCacheLines();
+
+  // For initializing values
+  std::vector<ref<ConstantExpr> > Init(size);
+
+  // First, the symbolic cache line tracking array (initialize to persisted).
+  Init.assign(size, getPersistedExpr());
+  const Array *cacheLines = arrayCache->CreateArray(object->name + "_cacheLines",
+                                                    size,
+                                                    &Init[0], &Init[0] + size,
+                                                    Expr::Int32 /* domain */,
+                                                    Expr::Int8 /* range */);
+  cacheLineUpdates = UpdateList(cacheLines, nullptr);
+  pendingCacheLineUpdates = UpdateList(cacheLineUpdates);
+  persistedCacheLines = cacheLines;
+
+  // Set up the root causes symbolic array (initialize to nullptr).
+  Init.assign(size, getNullptr());
+  const Array *rootWrites = arrayCache->CreateArray(
+                                            object->name + "_rootCauseWrites",
+                                            size,
+                                            &Init[0], &Init[0] + size,
+                                            Expr::Int32 /* domain */,
+                                            rootCauseWidth /* range */);
+  rootCauseWrites = UpdateList(rootWrites, nullptr);
+  pendingRootCauseWrites = UpdateList(rootCauseWrites);
+  noRootCauseWrites = rootWrites;
+
+  const Array *rootFlushes = arrayCache->CreateArray(
+                                            object->name + "_rootCauseFlushes",
+                                            size,
+                                            &Init[0], &Init[0] + size,
+                                            Expr::Int32 /* domain */,
+                                            rootCauseWidth /* range */);
+  rootCauseFlushes = UpdateList(rootFlushes, nullptr);
+  pendingRootCauseFlushes = UpdateList(rootCauseFlushes);
+}
+
 std::string PersistentState::getUniqueArrayName(ExecutionState &state, 
                                                 const char *suffix) const {
   std::string arrayName = getObject()->name + suffix;
@@ -1146,9 +1900,17 @@ std::string PersistentState::getUniqueArrayName(ExecutionState &state,
 }
 
 void PersistentState::flushAll() {
-  rootCauseWrites = UpdateList(rootCauseWrites.root, nullptr);
-  pendingRootCauseWrites = UpdateList(pendingRootCauseWrites.root, nullptr);
-  cacheLineUpdates = UpdateList(cacheLineUpdates.root, nullptr);
+  ++version;
+  // The roots may be compacted snapshots, so go back to the initial arrays.
+  rootCauseWrites = UpdateList(noRootCauseWrites, nullptr);
+  pendingRootCauseWrites = UpdateList(noRootCauseWrites, nullptr);
+  cacheLineUpdates = UpdateList(persistedCacheLines, nullptr);
+  releaseEventLog();
+  if (!symbolicTracking) {
+    dirtyLines.clear();
+    pendingDirtyLines.clear();
+    epochFlushedLines.clear();
+  }
   // pendingRootCauseWrites = UpdateList(pendingRootCauseWrites.root, nullptr);
   rootCauseMgr->clear();
 }
@@ -14,11 +14,14 @@
 #include "TimingSolver.h"
 #include "RootCause.h"
 
+#include "klee/Expr/Constraints.h"
 #include "klee/Expr/Expr.h"
 
 #include "llvm/ADT/StringExtras.h"
 
+#include <map>
 #include <memory>
+#include <set>
 #include <string>
 #include <vector>
 #include <unordered_map>
@@ -150,6 +153,31 @@ public:
   }
 };
 
+/// A pmem mapping made of contiguous, equally-sized MemoryObjects. The
+/// mapping is still backed by one PersistentState per chunk (so copy-on-write
+/// stays per chunk), but lookups by address are constant time.
+struct PersistentRegion {
+  uint64_t address;
+  uint64_t size;
+  uint64_t chunkSize;
+  std::vector<const MemoryObject *> chunks;
+
+  PersistentRegion(const std::vector<const MemoryObject *> &_chunks)
+    : address(_chunks.front()->address),
+      size(_chunks.size() * _chunks.front()->size),
+      chunkSize(_chunks.front()->size),
+      chunks(_chunks) {}
+
+  bool contains(uint64_t addr) const {
+    return addr >= address && addr - address < size;
+  }
+
+  const MemoryObject *getChunk(uint64_t addr) const {
+    assert(contains(addr) && "address outside of region!");
+    return chunks[(addr - address) / chunkSize];
+  }
+};
+
 class ObjectState {
 public:
   enum Kind {
@@ -328,6 +356,26 @@ class PersistentState : public ObjectState {
     UpdateList cacheLineUpdates;
     UpdateList pendingCacheLineUpdates;
 
+    /// Concrete fast path for the two update lists above.
+    ///
+    /// As long as every write and flush to this object has used a constant
+    /// offset (the common case), the state of each cache line is kept in
+    /// these sets of dirty cache lines instead, and cacheLineUpdates/
+    /// pendingCacheLineUpdates stay empty. dirtyLines mirrors cacheLineUpdates
+    /// and pendingDirtyLines mirrors pendingCacheLineUpdates. The sets are
+    /// sparse, so clean lines (most of a large pool) cost nothing.
+    ///
+    /// Since only flushes make the two views diverge, epochFlushedLines
+    /// records the lines flushed during the current epoch, which is all a
+    /// fence needs to commit.
+    ///
+    /// The first write or flush at a symbolic offset materializes the sets
+    /// into the update lists and sets symbolicTracking for good.
+    bool symbolicTracking;
+    std::set<unsigned> dirtyLines;
+    std::set<unsigned> pendingDirtyLines;
+    std::vector<unsigned> epochFlushedLines;
+
     /// This will be a ReadExpr on a symbolic offset into this object.
     /// Retrieved with getAnyOffsetExpr().
     ref<Expr> idxUnbounded;
@@ -390,13 +438,78 @@ class PersistentState : public ObjectState {
     // We could use pending flushes as an indicator for lacking fences.
     // Would need to clear them.
     UpdateList pendingRootCauseFlushes;
+    /// The initial (all persisted, no root causes) arrays. Compaction
+    /// replaces the roots of the lists above with constant snapshots, so
+    /// flushAll resets to these instead.
+    const Array *persistedCacheLines;
+    const Array *noRootCauseWrites;
     Expr::Width rootCauseWidth;
     // We store all of the unique root cause locations. We can't use the pointer
     // due to copies, but we can make unique IDs
     std::shared_ptr<RootCauseManager> rootCauseMgr;
 
-    // This should function like a stack
-    std::list<ref<Expr>> ignoreBytes;
+    /**
+     * Deferred root-cause attribution (--pmem-deferred-root-causes).
+     *
+     * Solving for the previous root cause of every write is expensive, and
+     * most of that work is wasted since most writes end up flushed. In this
+     * mode, the root cause update lists above are left untouched; instead,
+     * every write and flush is appended to an immutable log shared between
+     * clones, and root causes (along with the writes they mask) are only
+     * reconstructed from the log when an error is actually reported.
+     */
+    struct PersistEvent {
+      enum Kind { Write, Flush };
+
+      Kind kind;
+      ref<Expr> cacheLine;
+      const KInstruction *inst;
+      const CallStackNode *callStack;
+      /// The epoch the event happened in, flushes of earlier epochs have
+      /// been committed by a fence.
+      uint64_t epoch;
+      std::shared_ptr<const PersistEvent> prev;
+
+      PersistEvent(Kind k, ref<Expr> cl, const KInstruction *i, 
+                   const CallStackNode *cs, uint64_t e, 
+                   std::shared_ptr<const PersistEvent> p)
+        : kind(k), cacheLine(cl), inst(i), callStack(cs), epoch(e), prev(p) {}
+    };
+    std::shared_ptr<const PersistEvent> eventLog;
+    uint64_t epoch;
+
+    /// Byte ranges whose writes do not dirty their cache line (e.g. 
+    /// struct.volatile_byte fields). Ranges at concrete offsets are kept as
+    /// disjoint [start, end) intervals keyed by start, so checking a concrete
+    /// offset needs no solver query. Ranges at symbolic offsets are checked
+    /// with a single disjunctive query.
+    std::map<uint64_t, uint64_t> ignoreRanges;
+    std::vector<std::pair<ref<Expr>, uint64_t> > symbolicIgnoreRanges;
+
+    /// Bumped by every write, flush, fence or flushAll, i.e., whenever the
+    /// answer to "is this object persisted?" may change.
+    uint64_t version;
+
+    /**
+     * The result of the last persistence check of this object. It is shared
+     * by clones, which start out with the same contents, so states that
+     * share (or forked off) an unchanged object do not ask again.
+     */
+    struct PersistenceVerdict {
+      uint64_t version;
+      /// Whether the result was derived under the constraints below. If 
+      /// not, it holds for any state.
+      bool dependsOnConstraints;
+      ConstraintManager constraints;
+      /// The root causes of the unpersisted writes, empty if persisted.
+      std::unordered_set<uint64_t> rootCauses;
+    };
+    mutable std::shared_ptr<const PersistenceVerdict> verdict;
+
+    /// Set while a multi-byte write is in progress, so that the byte-sized
+    /// writes it is made of do not each dirty the cache line. The write
+    /// dirties every cache line it touches exactly once when it is done.
+    bool coalescingWrite;
 
     /// DO NOT USE. Use clone() instead.
     PersistentState(const PersistentState &ps);
@@ -414,6 +527,8 @@ class PersistentState : public ObjectState {
                     ExecutionState &state, 
                     const ObjectState *os);
 
+    ~PersistentState();
+
     ObjectState *clone() const override;
 
     virtual Kind getKind() const override { return Persistent; }
@@ -422,6 +537,13 @@ class PersistentState : public ObjectState {
       return os->getKind() == Persistent;
     }
 
+    void write(const ExecutionState &state, 
+               unsigned offset, 
+               ref<Expr> value) override;
+    void write(const ExecutionState &state, 
+               ref<Expr> offset, 
+               ref<Expr> value) override;
+
     void write8(const ExecutionState &state, 
                 unsigned offset, 
                 uint8_t value) override;
@@ -442,6 +564,13 @@ class PersistentState : public ObjectState {
      */
     void removeIgnoreByte(const ExecutionState &state, ref<Expr> offset);
     void removeIgnoreOffset(const ExecutionState &state, ref<Expr> offset, uint64_t width);
+    bool hasIgnoreRanges() const {
+      return !ignoreRanges.empty() || !symbolicIgnoreRanges.empty();
+    }
+    /// Whether a write of [offset, offset + bytes) leaves every cache line
+    /// clean because all of its bytes are ignored.
+    bool isIgnoredRange(const ExecutionState &state, ref<Expr> offset,
+                        unsigned bytes) const;
 
     void dirtyCacheLineAtOffset(const ExecutionState &state, unsigned offset);
     void dirtyCacheLineAtOffset(const ExecutionState &state, ref<Expr> offset);
@@ -449,6 +578,19 @@ class PersistentState : public ObjectState {
     // Make a *pending* persist of the cache line containing offset.
     void persistCacheLineAtOffset(const ExecutionState &state, unsigned offset);
     void persistCacheLineAtOffset(const ExecutionState &state, ref<Expr> offset);
+    // Same, but only if condition holds (a flush that may miss this object).
+    void persistCacheLineAtOffset(const ExecutionState &state, ref<Expr> offset,
+                                  ref<Expr> condition);
+
+    /**
+     * Dirty (or make a pending persist of) every cache line overlapping 
+     * [offset, offset + size) in one step. The whole span gets a single
+     * root cause, found with a single query, instead of one per line.
+     */
+    void dirtyRange(const ExecutionState &state, unsigned offset, unsigned size);
+    void dirtyRange(const ExecutionState &state, ref<Expr> offset, unsigned size);
+    void persistRange(const ExecutionState &state, unsigned offset, unsigned size);
+    void persistRange(const ExecutionState &state, ref<Expr> offset, unsigned size);
 
     /**
      * Returns true if there were any pending persists to commit. Otherwise,
@@ -472,6 +614,12 @@ class PersistentState : public ObjectState {
      */
     ref<Expr> getAnyOffsetExpr() const;
 
+    /**
+     * Returns true once a symbolic-offset write or flush has touched this
+     * object. Until then, persistence can be decided without the solver.
+     */
+    bool hasSymbolicTracking() const { return symbolicTracking; }
+
     // If we are known to be persistent, do this to optimize.
     void clearRootCauses();
 
@@ -483,10 +631,30 @@ class PersistentState : public ObjectState {
     uint64_t markFlushAsBug(ExecutionState &state, ref<Expr> offset) const;
 
     /**
-     * Mark all the writes that are unpersisted as bugs.
+     * Sort out the cache lines that may not be persisted, without the solver:
+     * lines which are definitely dirty, and lines which may be dirty along 
+     * with the condition under which they are.
+     */
+    void getUnpersistedCacheLines(
+        std::vector<unsigned> &dirty,
+        std::vector<std::pair<unsigned, ref<Expr> > > &maybeDirty) const;
+
+    /**
+     * Get the root causes found by the last persistence check (empty if the
+     * object was persisted), if nothing changed since and the result still
+     * holds under the constraints of the given state.
+     */
+    bool getCachedPersistenceVerdict(const ExecutionState &state,
+                                     std::unordered_set<uint64_t> &rootCauses) const;
+    void cachePersistenceVerdict(const ExecutionState &state,
+                                 const std::unordered_set<uint64_t> &rootCauses) const;
+
+    /**
+     * Mark the writes to the given unpersisted cache lines as bugs.
      */
     std::unordered_set<uint64_t> 
-    markNonPersistedWritesAsBugs(ExecutionState &state) const;
+    markNonPersistedWritesAsBugs(ExecutionState &state,
+                                 const std::vector<unsigned> &lines) const;
 
     ref<ConstantExpr> createRootCauseIdExpr(const ExecutionState &state, 
                                             RootCauseReason reason);
@@ -511,8 +679,14 @@ class PersistentState : public ObjectState {
     ref<Expr> isCacheLinePersisted(unsigned offset, bool pending=false) const;
     ref<Expr> isCacheLinePersisted(ref<Expr> offset, bool pending=false) const;
 
-    std::unordered_set<uint64_t> getRootCauses(ExecutionState &state,
-                                               const UpdateList &ul) const;
+    /// Build the update list equivalent to the concrete dirty line sets.
+    UpdateList getConcreteCacheLineUpdates(bool pending) const;
+    /// Switch from the concrete dirty line sets to the symbolic update lists.
+    void enableSymbolicTracking();
+    /// Make a pending persist of lines that were just dirtied, for 
+    /// persistency models where fences persist writes by themselves.
+    void flushWrittenLines(const ExecutionState &state,
+                           const std::vector<ref<Expr> > &cacheLines);
 
     std::unordered_set<uint64_t> getRootCause(const ExecutionState &state,
                                               const UpdateList &ul, 
@@ -522,13 +696,55 @@ class PersistentState : public ObjectState {
                                               const UpdateList &ul,
                                               ref<Expr> offset) const;
 
+    /// The root causes in ul of any cache line overlapping 
+    /// [offset, offset + size).
+    std::unordered_set<uint64_t> getRootCauseInRange(const ExecutionState &state,
+                                                     const UpdateList &ul,
+                                                     ref<Expr> offset,
+                                                     unsigned size) const;
+
+    void logPersistEvent(const ExecutionState &state, PersistEvent::Kind kind,
+                         ref<Expr> cacheLine);
+
+    /**
+     * Reconstruct the root causes of the given cache line from the event log.
+     * If pending, flushes of the current epoch count as persisted.
+     */
+    std::unordered_set<uint64_t> 
+    getDeferredRootCause(const ExecutionState &state,
+                         ref<Expr> cacheLine,
+                         bool pending) const;
+
+    bool mayHaveBeenFlushed(const ExecutionState &state,
+                            ref<Expr> cacheLine) const;
+
+    void releaseEventLog();
+
     static ref<Expr> ptrAsExpr(void *kinst);
 
     ref<Expr> getCacheLine(ref<Expr> offset) const;
+    /// The cache lines overlapping [offset, offset + size).
+    std::vector<ref<Expr> > getCacheLinesInRange(ref<Expr> offset,
+                                                 unsigned size) const;
     unsigned numCacheLines() const;
     unsigned cacheLineSize() const;
 
     std::string getUniqueArrayName(ExecutionState &state, const char *suffix) const;
+    void addIgnoreRange(ref<Expr> offset, uint64_t bytes);
+    void removeIgnoreRange(const ExecutionState &state, ref<Expr> offset,
+                           uint64_t bytes);
+    /// Whether writes to the given offset must not dirty its cache line.
+    bool isIgnoredOffset(const ExecutionState &state, ref<Expr> offset) const;
+    /// Whether [offset, offset + bytes) may overlap an ignored range.
+    bool mayOverlapIgnoreRange(unsigned offset, unsigned bytes) const;
+
+    /// Create the cache line and root cause arrays on first use.
+    void createTrackingArrays();
+
+    /// Fold the concrete prefixes of the committed update lists into
+    /// constant arrays (--pmem-compact-updates).
+    void compactUpdateLists();
+    UpdateList compactUpdateList(const UpdateList &ul) const;
 };
   
 } // End klee namespace
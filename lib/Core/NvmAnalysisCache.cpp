@@ -0,0 +1,325 @@
+//===-- NvmAnalysisCache.cpp ------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "NvmAnalysisCache.h"
+
+#include <cstdio>
+#include <fstream>
+
+#include <unistd.h>
+
+#include "llvm/IR/Constants.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "klee/Internal/Support/ErrorHandling.h"
+#include "klee/TimerStatIncrementer.h"
+
+#include "CoreStats.h"
+#include "NvmAnalysisUtils.h"
+
+using namespace llvm;
+using namespace klee;
+
+/* #region CL Options */
+
+namespace klee {
+  extern cl::OptionCategory NvmCat;
+
+  cl::opt<std::string> NvmAnalysisCacheDir(
+      "nvm-analysis-cache-dir",
+      cl::desc("Directory in which to keep the points-to analysis and static "
+               "priorities of each module across runs (default: none)"),
+      cl::init(""),
+      cl::cat(NvmCat));
+
+  cl::opt<bool> NvmRegenerateAnalysisCache(
+      "nvm-regenerate-analysis-cache",
+      cl::desc("Ignore the cached analysis of this module and rewrite it "
+               "(default=false)"),
+      cl::init(false),
+      cl::cat(NvmCat));
+}
+/* #endregion */
+
+static const char *CacheMagic = "klee-nvm-analysis-cache";
+static const unsigned CacheVersion = 3;
+
+NvmAnalysisCache::NvmAnalysisCache(Module *m)
+  : module_(m), hasNvmSites_(false), hasStaticPriorities_(false) {
+  if (NvmAnalysisCacheDir.empty()) return;
+
+  path_ = NvmAnalysisCacheDir + "/" + utils::hashModule(*m) + ".nvmcache";
+  if (!NvmRegenerateAnalysisCache && load()) {
+    klee_message("NVM: loaded analysis cache %s", path_.c_str());
+    return;
+  }
+
+  // We have to run the analysis anyways, so cache every value now rather
+  // than only the ones this run happens to query.
+  numberValues();
+  for (Value *v : numbering_->values()) {
+    if (!v->getType()->isPtrOrPtrVectorTy()) continue;
+    ValueSet ptsSet;
+    getPointsToSet(v, ptsSet);
+  }
+
+  save();
+}
+
+std::shared_ptr<NvmAnalysisCache> NvmAnalysisCache::get(Module *m) {
+  static std::unordered_map<const Module*,
+                            std::shared_ptr<NvmAnalysisCache> > caches;
+
+  auto &cache = caches[m];
+  if (!cache) cache.reset(new NvmAnalysisCache(m));
+  return cache;
+}
+
+AndersenAAWrapperPass &NvmAnalysisCache::andersen(void) {
+  if (!andersen_) andersen_ = utils::createAndersen(*module_);
+  return *andersen_;
+}
+
+bool NvmAnalysisCache::lookup(const Value *v, ValueSet &ptsSet, 
+                              bool &found) const {
+  auto it = pointsTo_.find(v);
+  if (it != pointsTo_.end()) {
+    ptsSet = it->second;
+    found = true;
+    return true;
+  }
+
+  found = false;
+  return noPointsTo_.count(v);
+}
+
+bool NvmAnalysisCache::getPointsToSet(const Value *v, ValueSet &ptsSet) {
+  bool found;
+  {
+    std::shared_lock<std::shared_timed_mutex> lock(mutex_);
+    if (lookup(v, ptsSet, found)) return found;
+  }
+
+  std::unique_lock<std::shared_timed_mutex> lock(mutex_);
+  // Someone else may have beaten us to it.
+  if (lookup(v, ptsSet, found)) return found;
+
+  AndersenAAWrapperPass &apa = andersen();
+  const ValueSet &sites = nvmAllocationSites();
+
+  TimerStatIncrementer timer(stats::nvmAndersenTime);
+  std::vector<const Value*> rawSet;
+  if (!apa.getResult().getPointsToSet(v, rawSet)) {
+    noPointsTo_.insert(v);
+    return false;
+  }
+
+  for (const Value *p : rawSet) {
+    if (sites.count(p)) ptsSet.insert(p);
+  }
+
+  pointsTo_[v] = ptsSet;
+  return true;
+}
+
+const NvmAnalysisCache::ValueSet &NvmAnalysisCache::getNvmAllocationSites(void) {
+  std::unique_lock<std::shared_timed_mutex> lock(mutex_);
+  return nvmAllocationSites();
+}
+
+const NvmAnalysisCache::ValueSet &NvmAnalysisCache::nvmAllocationSites(void) {
+  if (!hasNvmSites_) {
+    andersen();
+    nvmSites_ = utils::getNvmAllocationSites(module_, andersen_);
+    hasNvmSites_ = true;
+  }
+  return nvmSites_;
+}
+
+bool NvmAnalysisCache::getStaticPriorities(WeightMap &weights,
+                                           WeightMap &priorities) const {
+  std::shared_lock<std::shared_timed_mutex> lock(mutex_);
+  if (!hasStaticPriorities_) return false;
+
+  weights = weights_;
+  priorities = priorities_;
+  return true;
+}
+
+void NvmAnalysisCache::setStaticPriorities(const WeightMap &weights,
+                                           const WeightMap &priorities) {
+  std::unique_lock<std::shared_timed_mutex> lock(mutex_);
+  weights_ = weights;
+  priorities_ = priorities;
+  hasStaticPriorities_ = true;
+
+  if (!path_.empty()) save();
+}
+
+void NvmAnalysisCache::numberValues(void) {
+  if (!numbering_) numbering_.reset(new utils::ValueNumbering(*module_));
+}
+
+Value *NvmAnalysisCache::readValue(std::istream &is) const {
+  uint64_t id;
+  const std::vector<Value*> &values = numbering_->values();
+  if (!(is >> id) || id >= values.size()) return nullptr;
+  return values[id];
+}
+
+/**
+ * The format is line-based text:
+ *    klee-nvm-analysis-cache <version>
+ *    values <number of values in the module>
+ *    sites <n> <id>...
+ *    pts <id> <n> <id>...
+ *    none <id>
+ *    static <n>, followed by n lines of <id> <weight> <priority>
+ */
+bool NvmAnalysisCache::load(void) {
+  std::ifstream in(path_);
+  if (!in) return false;
+
+  std::string tag;
+  unsigned version;
+  if (!(in >> tag >> version) || tag != CacheMagic || version != CacheVersion) {
+    klee_warning("NVM: ignoring unrecognized analysis cache %s", path_.c_str());
+    return false;
+  }
+
+  numberValues();
+  uint64_t numValues;
+  if (!(in >> tag >> numValues) || tag != "values" ||
+      numValues != numbering_->values().size()) {
+    klee_warning("NVM: ignoring mismatched analysis cache %s", path_.c_str());
+    return false;
+  }
+
+  bool ok = true;
+  while (ok && in >> tag) {
+    uint64_t n;
+    if (tag == "sites") {
+      ok = !!(in >> n);
+      for (uint64_t i = 0; ok && i < n; ++i) {
+        Value *v = readValue(in);
+        ok = !!v;
+        if (ok) nvmSites_.insert(v);
+      }
+      hasNvmSites_ = ok;
+    } else if (tag == "pts") {
+      Value *v = readValue(in);
+      ok = v && (in >> n);
+      ValueSet &ptsSet = pointsTo_[v];
+      for (uint64_t i = 0; ok && i < n; ++i) {
+        Value *p = readValue(in);
+        ok = !!p;
+        if (ok) ptsSet.insert(p);
+      }
+    } else if (tag == "none") {
+      Value *v = readValue(in);
+      ok = !!v;
+      if (ok) noPointsTo_.insert(v);
+    } else if (tag == "static") {
+      ok = !!(in >> n);
+      // Only the non-zero entries are stored.
+      for (Value *v : numbering_->values()) {
+        if (Instruction *i = dyn_cast<Instruction>(v)) {
+          weights_[i] = 0lu;
+          priorities_[i] = 0lu;
+        }
+      }
+      for (uint64_t i = 0; ok && i < n; ++i) {
+        Instruction *inst = dyn_cast_or_null<Instruction>(readValue(in));
+        ok = inst && (in >> weights_[inst] >> priorities_[inst]);
+      }
+      hasStaticPriorities_ = ok;
+    } else {
+      ok = false;
+    }
+  }
+
+  if (!ok || !hasNvmSites_) {
+    klee_warning("NVM: ignoring corrupted analysis cache %s", path_.c_str());
+    pointsTo_.clear();
+    noPointsTo_.clear();
+    nvmSites_.clear();
+    weights_.clear();
+    priorities_.clear();
+    hasNvmSites_ = hasStaticPriorities_ = false;
+    return false;
+  }
+
+  return true;
+}
+
+void NvmAnalysisCache::save(void) const {
+  std::error_code ec = sys::fs::create_directories(NvmAnalysisCacheDir);
+  if (ec) {
+    klee_warning("NVM: could not create %s: %s",
+                 NvmAnalysisCacheDir.c_str(), ec.message().c_str());
+    return;
+  }
+
+  // Write to a private file first, so concurrent runs never see a partial
+  // cache.
+  std::string tmpPath = path_ + ".tmp." + std::to_string(getpid());
+  {
+    std::ofstream out(tmpPath);
+    out << CacheMagic << " " << CacheVersion << "\n";
+    out << "values " << numbering_->values().size() << "\n";
+
+    out << "sites " << nvmSites_.size();
+    for (const Value *v : nvmSites_) out << " " << numbering_->getId(v);
+    out << "\n";
+
+    for (const auto &p : pointsTo_) {
+      uint64_t id;
+      // Other constants are not found again in the next run.
+      if (!numbering_->getId(p.first, id)) continue;
+      out << "pts " << id << " " << p.second.size();
+      for (const Value *v : p.second) out << " " << numbering_->getId(v);
+      out << "\n";
+    }
+
+    for (const Value *v : noPointsTo_) {
+      uint64_t id;
+      if (numbering_->getId(v, id)) out << "none " << id << "\n";
+    }
+
+    if (hasStaticPriorities_) {
+      std::vector<Instruction*> nonZero;
+      for (const auto &p : weights_) {
+        auto prio = priorities_.find(p.first);
+        if (p.second || (prio != priorities_.end() && prio->second)) {
+          nonZero.push_back(p.first);
+        }
+      }
+
+      out << "static " << nonZero.size() << "\n";
+      for (Instruction *i : nonZero) {
+        auto prio = priorities_.find(i);
+        out << numbering_->getId(i) << " " << weights_.at(i) << " "
+            << (prio != priorities_.end() ? prio->second : 0lu) << "\n";
+      }
+    }
+
+    if (!out) {
+      klee_warning("NVM: could not write %s", tmpPath.c_str());
+      std::remove(tmpPath.c_str());
+      return;
+    }
+  }
+
+  if (std::rename(tmpPath.c_str(), path_.c_str())) {
+    klee_warning("NVM: could not write %s", path_.c_str());
+    std::remove(tmpPath.c_str());
+  }
+}
@@ -0,0 +1,119 @@
+//===-- NvmAnalysisCache.h --------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef __NVM_ANALYSIS_CACHE_H__
+#define __NVM_ANALYSIS_CACHE_H__
+
+#include <stdint.h>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "llvm/IR/Instruction.h"
+#include "llvm/IR/Module.h"
+
+#include "AndersenAA.h"
+#include "NvmAnalysisUtils.h"
+
+namespace klee {
+
+  /**
+   * Andersen's analysis is by far the most expensive part of setting up the
+   * NVM heuristics. This holds what the heuristics actually use from it---the
+   * points-to sets, filtered down to NVM allocation sites---along with the
+   * static priority tables, and shares them between all the heuristics of a
+   * module.
+   *
+   * With --nvm-analysis-cache-dir, this is also persisted across runs, keyed
+   * by a hash of the final module. The analysis itself is then only run if a
+   * value is queried that is not in the cache.
+   *
+   * Points-to queries are thread-safe, for the parallel warm-up of the 
+   * heuristics. Cache hits only take a shared lock.
+   */
+  class NvmAnalysisCache {
+    public:
+      typedef std::unordered_set<const llvm::Value*> ValueSet;
+      typedef std::unordered_map<llvm::Instruction*, uint64_t> WeightMap;
+
+    private:
+      llvm::Module *module_;
+      std::shared_ptr<AndersenAAWrapperPass> andersen_;
+
+      mutable std::shared_timed_mutex mutex_;
+
+      std::unordered_map<const llvm::Value*, ValueSet> pointsTo_;
+      // Values that Andersen's analysis has no points-to set for.
+      ValueSet noPointsTo_;
+
+      bool hasNvmSites_;
+      ValueSet nvmSites_;
+
+      bool hasStaticPriorities_;
+      WeightMap weights_, priorities_;
+
+      /**
+       * The cache file, or empty if we are not persisting.
+       */
+      std::string path_;
+
+      /**
+       * Values are stored by their ID, which is stable for identical modules.
+       */
+      std::unique_ptr<utils::ValueNumbering> numbering_;
+
+      NvmAnalysisCache(llvm::Module *m);
+
+      AndersenAAWrapperPass &andersen(void);
+
+      /**
+       * The unlocked versions of the public queries. lookup returns false if
+       * v is not cached, else sets found to whether it has a points-to set.
+       */
+      bool lookup(const llvm::Value *v, ValueSet &ptsSet, bool &found) const;
+      const ValueSet &nvmAllocationSites(void);
+
+      void numberValues(void);
+      llvm::Value *readValue(std::istream &is) const;
+
+      bool load(void);
+      void save(void) const;
+
+    public:
+      NvmAnalysisCache(const NvmAnalysisCache&) = delete;
+      NvmAnalysisCache &operator=(const NvmAnalysisCache&) = delete;
+
+      /**
+       * Returns the cache for the given module, loading or generating it on
+       * first use.
+       */
+      static std::shared_ptr<NvmAnalysisCache> get(llvm::Module *m);
+
+      /**
+       * Get the points-to set of v, restricted to NVM allocation sites.
+       * Returns false if the analysis has no result for v.
+       */
+      bool getPointsToSet(const llvm::Value *v, ValueSet &ptsSet);
+
+      const ValueSet &getNvmAllocationSites(void);
+
+      /**
+       * Returns false if the static priorities were not computed yet.
+       */
+      bool getStaticPriorities(WeightMap &weights, WeightMap &priorities) const;
+      void setStaticPriorities(const WeightMap &weights,
+                               const WeightMap &priorities);
+  };
+
+}
+
+#endif //__NVM_ANALYSIS_CACHE_H__
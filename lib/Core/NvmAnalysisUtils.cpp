@@ -2,6 +2,11 @@
 #include "klee/TimerStatIncrementer.h"
 #include "CoreStats.h"
 
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/Support/MD5.h"
+
 using namespace klee;
 using namespace llvm;
 using namespace std;
@@ -319,4 +324,62 @@ bool utils::isNvmAllocationSite(Module *m, const llvm::Value *v) {
   return false;
 }
 
+std::string utils::hashModule(const Module &m) {
+  SmallVector<char, 0> buffer;
+  raw_svector_ostream os(buffer);
+  WriteBitcodeToFile(m, os);
+
+  MD5 hash;
+  hash.update(StringRef(buffer.data(), buffer.size()));
+  MD5::MD5Result result;
+  hash.final(result);
+
+  SmallString<32> str;
+  MD5::stringifyResult(result, str);
+  return std::string(str.str());
+}
+
+utils::ValueNumbering::ValueNumbering(Module &m) {
+  for (GlobalVariable &gv : m.globals()) values_.push_back(&gv);
+  for (GlobalAlias &ga : m.aliases()) values_.push_back(&ga);
+  for (Function &f : m) values_.push_back(&f);
+
+  for (Function &f : m) {
+    for (Argument &arg : f.args()) values_.push_back(&arg);
+    for (BasicBlock &bb : f) {
+      for (Instruction &i : bb) values_.push_back(&i);
+    }
+  }
+
+  size_t numValues = values_.size();
+  for (uint64_t id = 0; id < numValues; ++id) ids_[values_[id]] = id;
+
+  for (uint64_t id = 0; id < numValues; ++id) {
+    Instruction *i = dyn_cast<Instruction>(values_[id]);
+    if (!i) continue;
+    for (Value *op : i->operands()) {
+      auto *ce = dyn_cast<ConstantExpr>(op);
+      if (ce && ce->getType()->isPtrOrPtrVectorTy() &&
+          ids_.emplace(ce, values_.size()).second) {
+        values_.push_back(ce);
+      }
+    }
+  }
+}
+
+bool utils::ValueNumbering::getId(const Value *v, uint64_t &id) const {
+  auto it = ids_.find(v);
+  if (it == ids_.end()) return false;
+  id = it->second;
+  return true;
+}
+
+uint64_t utils::ValueNumbering::getId(const Value *v) const {
+  uint64_t id;
+  bool numbered = getId(v, id);
+  assert(numbered && "value is not numbered");
+  (void) numbered;
+  return id;
+}
+
 /* vim: set tabstop=2 softtabstop=2 shiftwidth=2: */
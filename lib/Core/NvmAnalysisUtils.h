@@ -8,9 +8,11 @@
 #include <iostream>
 #include <iomanip>
 #include <map>
+#include <unordered_map>
 #include <unordered_set>
 #include <queue>
 #include <list>
+#include <string>
 
 #include "llvm/Pass.h"
 #include "llvm/IR/Function.h"
@@ -172,6 +174,41 @@ namespace utils {
                         const std::shared_ptr<AndersenAAWrapperPass> &ander);
 
   bool isNvmAllocationSite(llvm::Module *m, const llvm::Value *v);
+
+  /**
+   * A hash of the bitcode of the module, which identifies the same final
+   * module across runs.
+   */
+  std::string hashModule(const llvm::Module &m);
+
+  /**
+   * Numbers the values of a module by their position in it, which is the
+   * same for identical modules across runs: globals, aliases and functions,
+   * then the arguments and instructions of each function.
+   *
+   * Constant expressions have no position, but they are uniqued, so the
+   * first instruction operand that is one identifies it just as well. Those
+   * of pointer type, like the GEPs of stores to globals, follow in the order
+   * of their first use.
+   */
+  class ValueNumbering {
+    std::vector<llvm::Value*> values_;
+    std::unordered_map<const llvm::Value*, uint64_t> ids_;
+
+    public:
+      explicit ValueNumbering(llvm::Module &m);
+
+      /**
+       * By ID, the IDs start at 0.
+       */
+      const std::vector<llvm::Value*> &values(void) const { return values_; }
+
+      /**
+       * Returns false if v is not numbered.
+       */
+      bool getId(const llvm::Value *v, uint64_t &id) const;
+      uint64_t getId(const llvm::Value *v) const;
+  };
 }
 }
 #endif //__NVM_ANALYSIS_UTILS_H__
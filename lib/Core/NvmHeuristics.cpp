@@ -4,10 +4,14 @@ using namespace llvm;
 using namespace std;
 using namespace klee;
 
+#include <mutex>
 #include <sstream>
 #include <utility>
 
+#include "klee/Config/Version.h"
+
 #include "llvm/IR/GlobalAlias.h"
+#include "llvm/Support/ThreadPool.h"
 
 #include "CoreStats.h"
 #include "Executor.h"
@@ -41,9 +45,54 @@ namespace klee {
                     cl::NotHidden,
                     cl::aliasopt(NvmCheck),
                     cl::cat(NvmCat));
+
+  cl::opt<unsigned>
+  NvmContextCacheSize("nvm-context-cache-size",
+        cl::desc("Maximum number of function contexts the dynamic NVM "
+                 "heuristic caches, least recently used first out "
+                 "(0=unbounded, default=4096)"),
+        cl::init(4096),
+        cl::cat(NvmCat));
+
+  cl::opt<bool>
+  NvmExpensiveChecks("nvm-expensive-checks",
+        cl::desc("Check every incremental update of the dynamic NVM "
+                 "heuristic against computing it again, which is slow "
+                 "(default=false)"),
+        cl::init(false),
+        cl::cat(NvmCat));
+
+  cl::opt<unsigned>
+  NvmHeuristicThreads("nvm-heuristic-threads",
+        cl::desc("Number of threads used to compute the NVM heuristic ahead "
+                 "of time at startup (default=1, i.e. on demand)"),
+        cl::init(1),
+        cl::cat(NvmCat));
 }
 /* #endregion */
 
+/**
+ * Runs body(0) ... body(n - 1) on --nvm-heuristic-threads threads. The body 
+ * may only share points-to queries with the other threads; the statistics 
+ * and the context cache are not thread-safe.
+ */
+static void parallelFor(size_t n, const std::function<void(size_t)> &body) {
+  if (NvmHeuristicThreads <= 1 || n <= 1) {
+    for (size_t i = 0; i < n; ++i) body(i);
+    return;
+  }
+
+#if LLVM_VERSION_CODE >= LLVM_VERSION(11, 0)
+  ThreadPool pool(hardware_concurrency(NvmHeuristicThreads));
+#else
+  ThreadPool pool(NvmHeuristicThreads);
+#endif
+  for (size_t i = 0; i < n; ++i) {
+    pool.async([&body, i] { body(i); });
+  }
+  pool.wait();
+}
+
 /* #region NvmValueDesc */
 
 bool NvmValueDesc::getPointsToSet(const Value *v, 
@@ -53,27 +102,47 @@ bool NvmValueDesc::getPointsToSet(const Value *v,
    * as the call to "getPointsToSet" has to re-traverse a bunch of internal 
    * data structures to construct the set.
    */
-  TimerStatIncrementer timer(stats::nvmAndersenTime);
-  bool ret = true;
-  if (!anders_cache_->count(v)) {
-    std::vector<const Value*> rawSet;
-    ret = andersen_->getResult().getPointsToSet(v, rawSet);
-    if (ret) {
-      for (const Value *v : rawSet) {
-        if (nvm_allocs_.count(v)) ptsSet.insert(v);
-      }
+  return analysis_->getPointsToSet(v, ptsSet);
+}
 
-      (*anders_cache_)[v] = ptsSet;
-    }
-  } else {
-    ptsSet = (*anders_cache_)[v];
-  }
+uint64_t NvmValueDesc::hashSet(const ValueSet &set) {
+  uint64_t hash = 0;
+  for (const Value *v : set) hash ^= hashValue(v);
+  return hash;
+}
+
+NvmValueDesc::SharedValueSet NvmValueDesc::emptySet(void) {
+  static SharedValueSet empty = std::make_shared<const ValueSet>();
+  return empty;
+}
+
+bool NvmValueDesc::insertValue(SharedValueSet &set, uint64_t &hash,
+                               const Value *v) {
+  if (set->count(v)) return false;
+
+  auto copy = std::make_shared<ValueSet>(*set);
+  copy->insert(v);
+  set = copy;
+  hash ^= hashValue(v);
+  return true;
+}
+
+bool NvmValueDesc::eraseValue(SharedValueSet &set, uint64_t &hash,
+                              const Value *v) {
+  if (!set->count(v)) return false;
 
-  return ret;
+  auto copy = std::make_shared<ValueSet>(*set);
+  copy->erase(v);
+  set = copy;
+  hash ^= hashValue(v);
+  return true;
 }
 
 NvmValueDesc::Shared NvmValueDesc::doCall(CallBase *cb, Function *f) const {
-  NvmValueDesc newDesc(andersen_, anders_cache_, nvm_allocs_, not_global_nvm_);
+  // Only the globals carry over; the locals are rebuilt from the arguments.
+  NvmValueDesc newDesc = *this;
+  newDesc.not_local_nvm_ = emptySet();
+  newDesc.local_hash_ = 0;
 
   if (!f) {
     f = utils::getCallInstFunction(cb);
@@ -113,7 +182,7 @@ NvmValueDesc::Shared NvmValueDesc::doCall(CallBase *cb, Function *f) const {
       assert(arg);
       // Scalars don't necessarily point to anything.
       if (!arg->getType()->isPtrOrPtrVectorTy()) continue;
-      newDesc.not_local_nvm_.insert(arg);
+      insertValue(newDesc.not_local_nvm_, newDesc.local_hash_, arg);
     }
 
   }
@@ -121,6 +190,33 @@ NvmValueDesc::Shared NvmValueDesc::doCall(CallBase *cb, Function *f) const {
   return std::make_shared<NvmValueDesc>(newDesc);
 }
 
+bool NvmValueDesc::updateMayAffectCall(const Value *val, CallBase *cb) const {
+  // The globals carry over into every call.
+  if (isa<GlobalValue>(val)) return true;
+
+  // A local only changes whether the values it is, or that use it, are known
+  // to be volatile (see matchesKnownVolatile), so only arguments that point
+  // to one of those are affected.
+  for (unsigned i = 0; i < (unsigned)cb->getNumArgOperands(); ++i) {
+    Value *op = cb->getArgOperand(i);
+    if (!op->getType()->isPtrOrPtrVectorTy()) continue;
+
+    std::unordered_set<const Value*> ptsSet;
+    if (!getPointsToSet(op, ptsSet)) return true;
+    for (const Value *ptsTo : ptsSet) {
+      if (ptsTo == val) return true;
+
+      const auto *u = dyn_cast<User>(ptsTo);
+      if (!u || isa<CallBase>(u)) continue;
+      for (const Use &use : u->operands()) {
+        if (use.get() == val) return true;
+      }
+    }
+  }
+
+  return false;
+}
+
 NvmValueDesc::Shared NvmValueDesc::doReturn(NvmValueDesc::Shared callerVals,
                                             ReturnInst *ri,
                                             Instruction *dest) const {
@@ -195,22 +291,22 @@ bool NvmValueDesc::pointsToIsEq(const Value *a, const Value *b) const {
 
 bool NvmValueDesc::matchesKnownVolatile(const Value *posNvm) const {
   if (isa<GlobalValue>(posNvm)) {
-    if (not_global_nvm_.count(posNvm)) {
+    if (not_global_nvm_->count(posNvm)) {
       return true;
     }
 
-    for (const Value *vol : not_global_nvm_) {
+    for (const Value *vol : *not_global_nvm_) {
       for (const User *u : vol->users()) {
         if (isa<CallBase>(u)) continue;
         if (u == posNvm) return true;
       }
     }
   } else {
-    if (not_local_nvm_.count(posNvm)) {
+    if (not_local_nvm_->count(posNvm)) {
       return true;
     }
 
-    for (const Value *vol : not_local_nvm_) {
+    for (const Value *vol : *not_local_nvm_) {
       for (const User *u : vol->users()) {
         if (isa<CallBase>(u)) continue;
         if (u == posNvm) return true;
@@ -233,14 +329,16 @@ NvmValueDesc::Shared NvmValueDesc::updateState(Value *val, bool isNvm) {
      */
     if (isa<GlobalValue>(val)) {
       NvmValueDesc vd = *this;
-      vd.not_global_nvm_.erase(val);
+      if (!eraseValue(vd.not_global_nvm_, vd.global_hash_, val)) {
+        return shared_from_this();
+      }
       return std::make_shared<NvmValueDesc>(vd);
     } else {
       errs() << *val << " @ " << dyn_cast<Instruction>(val)->getFunction()->getName() << "\n";
       std::unordered_set<const Value *> ptsSet;
       getPointsToSet(val, ptsSet);
       for (const Value *v : ptsSet) errs() << "\t" << *v << "\n";
-      for (const Value *v : not_local_nvm_) {
+      for (const Value *v : *not_local_nvm_) {
         // is it a user of any not local nvm?
         for (const User *u : v->users()) {
           errs() << "\t\tNOT LOCAL NVM: " << *v << ";\n\t\t\t User " << *u << "\n";
@@ -251,11 +349,10 @@ NvmValueDesc::Shared NvmValueDesc::updateState(Value *val, bool isNvm) {
   } else if (!isNvm && !matchesKnownVolatile(val)) {
     NvmValueDesc vd = *this;
 
-    if (isa<GlobalValue>(val)) {
-      vd.not_global_nvm_.insert(val);
-    } else {
-      vd.not_local_nvm_.insert(val);
-    }
+    bool changed = isa<GlobalValue>(val)
+      ? insertValue(vd.not_global_nvm_, vd.global_hash_, val)
+      : insertValue(vd.not_local_nvm_, vd.local_hash_, val);
+    if (!changed) return shared_from_this();
     
     return std::make_shared<NvmValueDesc>(vd);
   }
@@ -272,14 +369,14 @@ bool NvmValueDesc::isNvm(const Value *ptr) const {
     return false;
   }
 
-  if (!nvm_allocs_.size()) {
+  if (!nvm_allocs_->size()) {
     errs() << "\t!!!!cannot point because no calls!\n"; 
   }
   
   if (matchesKnownVolatile(ptr)) return false;
 
   bool may_point_nvm_alloc = false;
-  for (const Value *mm : nvm_allocs_) {
+  for (const Value *mm : *nvm_allocs_) {
     if (mayPointTo(ptr, mm)) {
       may_point_nvm_alloc = true;
       // errs() << "\t++++may point to NVM!\n\t\t";
@@ -302,10 +399,10 @@ bool NvmValueDesc::isNvm(const Value *ptr) const {
         if (!matchesKnownVolatile(apa, q)) return true;
       }
       #elif 0
-      for (const Value *l : not_local_nvm_) {
+      for (const Value *l : *not_local_nvm_) {
         if (pointsToIsEq(l, ptr)) return false;
       }
-      for (const Value *l : not_global_nvm_) {
+      for (const Value *l : *not_global_nvm_) {
         if (pointsToIsEq(l, ptr)) return false;
       }
       #elif 0
@@ -338,13 +435,15 @@ bool NvmValueDesc::mayModifyNvm(const Instruction *i) const {
   return false;
 }
 
-NvmValueDesc::Shared NvmValueDesc::staticState(SharedAndersen apa, llvm::Module *m) {
+NvmValueDesc::Shared NvmValueDesc::staticState(SharedNvmAnalysis analysis, 
+                                               llvm::Module *m) {
   NvmValueDesc desc;
-  desc.andersen_ = apa;
-  desc.anders_cache_ = std::make_shared<NvmValueDesc::AndersenCache>();
-  desc.nvm_allocs_ = utils::getNvmAllocationSites(m, apa);
+  desc.analysis_ = analysis;
+  desc.nvm_allocs_ = 
+    std::make_shared<const ValueSet>(analysis->getNvmAllocationSites());
+  desc.allocs_hash_ = hashSet(*desc.nvm_allocs_);
 
-  assert(desc.nvm_allocs_.size() && "No mmap calls?");
+  assert(desc.nvm_allocs_->size() && "No mmap calls?");
 
   return std::make_shared<NvmValueDesc>(desc);
 }
@@ -352,22 +451,22 @@ NvmValueDesc::Shared NvmValueDesc::staticState(SharedAndersen apa, llvm::Module
 std::string NvmValueDesc::str(void) const {
   std::stringstream s;
   s << "Value State:\n";
-  s << "\n\tNumber of nvm allocation sites: " << nvm_allocs_.size();
-  for (const Value *v : nvm_allocs_) {
+  s << "\n\tNumber of nvm allocation sites: " << nvm_allocs_->size();
+  for (const Value *v : *nvm_allocs_) {
     std::string tmp;
     llvm::raw_string_ostream rs(tmp);
     v->print(rs);
     s << "\n\t\t" << tmp;
   }
-  s << "\n\tNumber of known global runtime non-nvm values: " << not_global_nvm_.size();
-  for (const Value *v : not_global_nvm_) {
+  s << "\n\tNumber of known global runtime non-nvm values: " << not_global_nvm_->size();
+  for (const Value *v : *not_global_nvm_) {
     std::string tmp;
     llvm::raw_string_ostream rs(tmp);
     v->print(rs);
     s << "\n\t\t" << tmp;
   }
-  s << "\n\tNumber of known local runtime non-nvm values: " << not_local_nvm_.size();
-  for (const Value *v : not_local_nvm_) {
+  s << "\n\tNumber of known local runtime non-nvm values: " << not_local_nvm_->size();
+  for (const Value *v : *not_local_nvm_) {
     std::string tmp;
     llvm::raw_string_ostream rs(tmp);
     v->print(rs);
@@ -376,36 +475,138 @@ std::string NvmValueDesc::str(void) const {
   return s.str();
 }
 
+static bool sameSet(const NvmValueDesc::SharedValueSet &lhs, 
+                    const NvmValueDesc::SharedValueSet &rhs) {
+  return lhs == rhs || *lhs == *rhs;
+}
+
 bool klee::operator==(const NvmValueDesc &lhs, const NvmValueDesc &rhs) {
-  return lhs.nvm_allocs_ == rhs.nvm_allocs_ &&
-         lhs.not_global_nvm_ == rhs.not_global_nvm_ &&
-         lhs.not_local_nvm_ == rhs.not_local_nvm_;
+  if (&lhs == &rhs) return true;
+  // The hashes are cheap to compare and settle most inequalities.
+  if (lhs.allocs_hash_ != rhs.allocs_hash_ ||
+      lhs.global_hash_ != rhs.global_hash_ ||
+      lhs.local_hash_ != rhs.local_hash_) return false;
+
+  return sameSet(lhs.nvm_allocs_, rhs.nvm_allocs_) &&
+         sameSet(lhs.not_global_nvm_, rhs.not_global_nvm_) &&
+         sameSet(lhs.not_local_nvm_, rhs.not_local_nvm_);
 }
 
 /* #endregion */
 
 /* #region NvmContextDesc */
 
-std::unordered_map<NvmContextDesc::ContextCacheKey, 
-                   NvmContextDesc::Shared,
-                   NvmContextDesc::ContextCacheKey::Hash> NvmContextDesc::contextCache;
+NvmContextDesc::ContextCache NvmContextDesc::contextCache;
+
+NvmContextDesc::Shared 
+NvmContextDesc::ContextCache::get(const ContextCacheKey &key) {
+  auto it = index.find(key);
+  if (it == index.end()) {
+    ++stats::nvmContextCacheMisses;
+    return nullptr;
+  }
+
+  ++stats::nvmContextCacheHits;
+  lru.splice(lru.begin(), lru, it->second);
+  return it->second->second;
+}
+
+void NvmContextDesc::ContextCache::put(const ContextCacheKey &key, 
+                                       NvmContextDesc::Shared ctx) {
+  auto it = index.find(key);
+  if (it != index.end()) {
+    it->second->second = ctx;
+    lru.splice(lru.begin(), lru, it->second);
+    return;
+  }
+
+  lru.emplace_front(key, ctx);
+  index.emplace(key, lru.begin());
+  evict();
+}
+
+void NvmContextDesc::ContextCache::evict(void) {
+  if (!bounded || !NvmContextCacheSize) return;
+  while (lru.size() > NvmContextCacheSize) {
+    index.erase(lru.back().first);
+    lru.pop_back();
+  }
+}
+
+void NvmContextDesc::ContextCache::setBounded(bool b) {
+  bounded = b;
+  evict();
+}
 
-NvmContextDesc::NvmContextDesc(SharedAndersen anders,
+NvmContextDesc::FunctionLayout::FunctionLayout(Function *f) 
+  : numInstructions(0), rootIndex(0) {
+  Instruction *root = f->getEntryBlock().getFirstNonPHIOrDbg();
+  for (BasicBlock &bb : *f) {
+    unsigned first = numInstructions;
+    for (Instruction &i : bb) {
+      if (&i == root) rootIndex = numInstructions;
+      if (isa<StoreInst>(&i) || utils::isFlush(&i) || utils::isFence(&i)) {
+        coreCandidates.emplace_back(numInstructions, &i);
+      }
+      if (NvmContextDesc::isaAuxInst(&i)) {
+        auxInsts.emplace_back(numInstructions, &i);
+      }
+      ++numInstructions;
+    }
+    blocks[&bb] = std::make_pair(first, numInstructions - 1);
+  }
+}
+
+std::shared_ptr<const NvmContextDesc::FunctionLayout> 
+NvmContextDesc::FunctionLayout::get(Function *f) {
+  static std::unordered_map<const Function*, 
+                            std::shared_ptr<const FunctionLayout> > layouts;
+  // Contexts may be built concurrently at startup.
+  static std::mutex mutex;
+  std::lock_guard<std::mutex> lock(mutex);
+
+  auto &layout = layouts[f];
+  if (!layout) layout = std::make_shared<const FunctionLayout>(f);
+  return layout;
+}
+
+NvmContextDesc::NvmContextDesc(SharedNvmAnalysis analysis,
                                Function *f,
                                NvmValueDesc::Shared initialArgs,
                                bool parentHasWeight) 
-  : andersen(anders),
+  : analysis(analysis),
     function(f),
     valueState(initialArgs),
-    returnHasWeight(parentHasWeight) {}
+    returnHasWeight(parentHasWeight),
+    layout(FunctionLayout::get(f)),
+    weights(std::make_shared<Table>(layout->numInstructions, 0lu)),
+    priorities(std::make_shared<Table>(layout->numInstructions, 0lu)) {}
 
-NvmContextDesc::NvmContextDesc(SharedAndersen anders, 
+NvmContextDesc::NvmContextDesc(SharedNvmAnalysis analysis, 
                                Module *m, 
                                Function *main) 
-  : andersen(anders),
+  : analysis(analysis),
     function(main),
-    valueState(NvmValueDesc::staticState(anders, m)),
-    returnHasWeight(false) {}
+    valueState(NvmValueDesc::staticState(analysis, m)),
+    returnHasWeight(false),
+    layout(FunctionLayout::get(main)),
+    weights(std::make_shared<Table>(layout->numInstructions, 0lu)),
+    priorities(std::make_shared<Table>(layout->numInstructions, 0lu)) {}
+
+NvmContextDesc::Table &
+NvmContextDesc::mutableTable(std::shared_ptr<Table> &table) {
+  if (table.use_count() > 1) {
+    table = std::make_shared<Table>(*table);
+  }
+  return *table;
+}
+
+void NvmContextDesc::setWeight(unsigned index, uint64_t weight) {
+  // Only unshare the table for an actual change.
+  if ((*weights)[index] != weight) {
+    mutableTable(weights)[index] = weight;
+  }
+}
 
 uint64_t NvmContextDesc::constructCalledContext(llvm::CallBase *cb, 
                                                 llvm::Function *f) {
@@ -413,15 +614,15 @@ uint64_t NvmContextDesc::constructCalledContext(llvm::CallBase *cb,
 
   // First, we check the cache.
   ContextCacheKey key(f, valueState->doCall(cb, f));
-  if (contextCache.count(key)) {
-    contexts[cb] = contextCache[key];
-    return contextCache[key]->getRootPriority();
+  if (NvmContextDesc::Shared cached = contextCache.get(key)) {
+    contexts[cb] = cached;
+    return cached->getRootPriority();
   }
 
   Instruction *retLoc = utils::getReturnLocation(cb);
   assert(retLoc && "could not get the return instruction");
 
-  NvmContextDesc calledCtx(andersen,
+  NvmContextDesc calledCtx(analysis,
                            key.function,
                            key.valueState,
                            hasCoreWeight);
@@ -431,7 +632,7 @@ uint64_t NvmContextDesc::constructCalledContext(llvm::CallBase *cb,
 
   // We add it first to avoid infinite recursion.
   contexts[cb] = sharedCtx;
-  contextCache[key] = sharedCtx;
+  contextCache.put(key, sharedCtx);
 
   // We can do this later as it mutates the object
   sharedCtx->setAuxWeights(std::move(auxInsts));
@@ -440,6 +641,101 @@ uint64_t NvmContextDesc::constructCalledContext(llvm::CallBase *cb,
   return sharedCtx->getRootPriority();
 }
 
+std::vector<NvmContextDesc::ContextCacheKey> 
+NvmContextDesc::calledContextKeys(void) const {
+  std::vector<ContextCacheKey> keys;
+  for (const auto &p : layout->auxInsts) {
+    auto *cb = dyn_cast<CallBase>(p.second);
+    if (!cb) continue;
+    if (Function *f = cb->getCalledFunction()) {
+      keys.emplace_back(f, valueState->doCall(cb, f));
+    }
+  }
+  return keys;
+}
+
+void NvmContextDesc::precomputeCalledContexts(void) {
+  if (NvmHeuristicThreads <= 1) return;
+
+  std::unordered_set<ContextCacheKey, ContextCacheKey::Hash> seen;
+  // The keys of the next wave, with whether their caller has core weights.
+  std::vector<std::pair<ContextCacheKey, bool> > wave;
+  auto enqueue = [&](const NvmContextDesc &caller, 
+                     std::vector<ContextCacheKey> &callees) {
+    callees = caller.calledContextKeys();
+    for (const ContextCacheKey &key : callees) {
+      if (contextCache.contains(key) || !seen.insert(key).second) continue;
+      wave.emplace_back(key, caller.hasCoreWeight);
+    }
+  };
+  std::vector<ContextCacheKey> rootCallees;
+  enqueue(*this, rootCallees);
+
+  std::vector<std::pair<ContextCacheKey, Shared> > built;
+  std::vector<AuxInstList> builtAuxInsts;
+  std::vector<std::vector<ContextCacheKey> > builtCallees;
+  while (!wave.empty()) {
+    std::vector<Shared> ctxs(wave.size());
+    std::vector<AuxInstList> auxInsts(wave.size());
+
+    parallelFor(wave.size(), [&](size_t i) {
+      const ContextCacheKey &key = wave[i].first;
+      ctxs[i].reset(new NvmContextDesc(analysis, key.function, 
+                                       key.valueState, wave[i].second));
+      auxInsts[i] = ctxs[i]->setCoreWeights();
+    });
+
+    std::vector<std::pair<ContextCacheKey, bool> > current;
+    current.swap(wave);
+    for (size_t i = 0; i < current.size(); ++i) {
+      builtCallees.emplace_back();
+      enqueue(*ctxs[i], builtCallees.back());
+      built.emplace_back(current[i].first, ctxs[i]);
+      builtAuxInsts.push_back(std::move(auxInsts[i]));
+    }
+  }
+
+  // A context is only built in the wave of its shallowest caller, so the
+  // waves are not callees first. A post-order of the calls between the
+  // built contexts is, except where they recurse.
+  std::unordered_map<ContextCacheKey, size_t, ContextCacheKey::Hash> indices;
+  for (size_t i = 0; i < built.size(); ++i) indices[built[i].first] = i;
+
+  std::vector<size_t> order;
+  std::vector<bool> visited(built.size(), false);
+  // The contexts on the path of the search, with their next callee.
+  std::vector<std::pair<size_t, size_t> > stack;
+  for (size_t root = 0; root < built.size(); ++root) {
+    if (visited[root]) continue;
+    visited[root] = true;
+    stack.emplace_back(root, 0);
+    while (!stack.empty()) {
+      size_t i = stack.back().first;
+      size_t &next = stack.back().second;
+      if (next == builtCallees[i].size()) {
+        order.push_back(i);
+        stack.pop_back();
+        continue;
+      }
+
+      auto it = indices.find(builtCallees[i][next++]);
+      if (it == indices.end() || visited[it->second]) continue;
+      visited[it->second] = true;
+      stack.emplace_back(it->second, 0);
+    }
+  }
+
+  // As in constructCalledContext, the contexts are cached before their aux
+  // weights are set, so that recursive calls find them.
+  contextCache.setBounded(false);
+  for (const auto &p : built) contextCache.put(p.first, p.second);
+  for (size_t i : order) {
+    built[i].second->setAuxWeights(std::move(builtAuxInsts[i]));
+    built[i].second->setPriorities();
+  }
+  contextCache.setBounded(true);
+}
+
 uint64_t NvmContextDesc::constructCalledContext(llvm::CallBase *cb) {
   if (Function *f = cb->getCalledFunction()) {
     return constructCalledContext(cb, f);
@@ -468,7 +764,7 @@ bool NvmContextDesc::isaCoreInst(Instruction *i) const {
   return false;
 }
 
-bool NvmContextDesc::isaAuxInst(Instruction *i) const {
+bool NvmContextDesc::isaAuxInst(Instruction *i) {
   if (auto *cb = dyn_cast<CallBase>(i)) {
     if (auto *f = cb->getCalledFunction()) {
       if (f->isDeclaration() || f->isIntrinsic()) return false;
@@ -503,6 +799,32 @@ void NvmContextDesc::setPriorities(void) {
     if (succ_empty(&bb)) toProp.push_back(&bb);
   }
 
+  propagatePriorities(std::move(toProp), false);
+}
+
+void NvmContextDesc::updatePriorities(const std::vector<WeightChange> &changes) {
+  Table &prio = mutableTable(priorities);
+  const Table &w = *weights;
+
+  std::list<BasicBlock*> toProp;
+  std::unordered_set<BasicBlock*> seeded;
+  for (const WeightChange &c : changes) {
+    // A terminator's priority includes its own weight.
+    unsigned term = layout->blocks.at(c.block).second;
+    if (c.index == term && prio[term] >= c.oldWeight) {
+      prio[term] = prio[term] - c.oldWeight + w[term];
+    }
+    if (seeded.insert(c.block).second) toProp.push_back(c.block);
+  }
+
+  propagatePriorities(std::move(toProp), true);
+}
+
+void NvmContextDesc::propagatePriorities(std::list<BasicBlock*> toProp,
+                                         bool incremental) {
+  Table &prio = mutableTable(priorities);
+  const Table &w = *weights;
+
   // Now, we bubble up the priorities.
   std::unordered_set<BasicBlock*> traversed; // Loop detection
   while (toProp.size()) {
@@ -513,54 +835,102 @@ void NvmContextDesc::setPriorities(void) {
     traversed.insert(bb);
 
     // Bubble up priorities along the instructions in this basic block.
-    Instruction *curr = bb->getTerminator();
-    if (!priorities[curr]) {
-      priorities[curr] = weights[curr];
+    const auto &range = layout->blocks.at(bb);
+    unsigned curr = range.second;
+    if (!prio[curr]) {
+      prio[curr] = w[curr];
     }
 
-    while(Instruction *pred = curr->getPrevNode()) {
-      priorities[pred] = weights[pred] + priorities[curr];
-      curr = pred;
+    for (; curr > range.first; --curr) {
+      prio[curr - 1] = w[curr - 1] + prio[curr];
     }
 
     // Now, we need to get the predecessor basic blocks
     for (BasicBlock *predBB : predecessors(bb)) {
-      Instruction *pterm = predBB->getTerminator();
-      uint64_t basePriority = weights[pterm] + priorities[curr];
-      uint64_t currPriority = priorities[pterm];
+      unsigned pterm = layout->blocks.at(predBB).second;
+      uint64_t basePriority = w[pterm] + prio[curr];
+      uint64_t currPriority = prio[pterm];
       // For loops, if the predecessors have already been traversed, but this
       // block changed the bottom-most priority, then we add it to the list
       // to repropagate it anyways.
       if (!traversed.count(predBB) || (basePriority && !currPriority)) {
-        priorities[pterm] = basePriority + weights[pterm];
+        uint64_t newPriority = basePriority + w[pterm];
+        if (incremental && newPriority == currPriority) continue;
+
+        prio[pterm] = newPriority;
         toProp.push_back(predBB);
       } 
     }
   }
+
+  if (traversed.count(&function->getEntryBlock())) {
+    hasRootPriority = true;
+  }
 }
 
-std::list<Instruction*> NvmContextDesc::setCoreWeights(void) {
+NvmContextDesc::AuxInstList NvmContextDesc::setCoreWeights(void) {
   // I will accumulate these as I iterate so we don't have to re-iterate over
   // the entire function as we resolve core instructions.
-  std::list<Instruction*> auxInsts;
+  AuxInstList auxInsts;
 
+  unsigned index = 0;
   for (BasicBlock &bb : *function) {
     for (Instruction &i : bb) {
       if (isaCoreInst(&i)) {
-        weights[&i] = 3lu;
+        setWeight(index, 3lu);
         hasCoreWeight = true;
       } else if (isaAuxInst(&i)) {
-        auxInsts.push_back(&i);
+        auxInsts.emplace_back(index, &i);
       }
+      ++index;
     }
   }
 
   return auxInsts;
 }
 
-void NvmContextDesc::setAuxWeights(std::list<Instruction*> auxInsts) {
-  for (Instruction *i : auxInsts) {
-    weights[i] = computeAuxInstWeight(i);
+void NvmContextDesc::setAuxWeights(AuxInstList auxInsts) {
+  for (const auto &p : auxInsts) {
+    setWeight(p.first, computeAuxInstWeight(p.second));
+  }
+}
+
+/**
+ * Weights only ever become core weights, so only the instructions that are
+ * not core yet need to be asked again.
+ */
+void NvmContextDesc::updateCoreWeights(std::vector<WeightChange> &changes) {
+  for (const auto &p : layout->coreCandidates) {
+    uint64_t oldWeight = (*weights)[p.first];
+    if (oldWeight == 3lu || !isaCoreInst(p.second)) continue;
+
+    changes.push_back({p.second->getParent(), p.first, oldWeight});
+    setWeight(p.first, 3lu);
+    hasCoreWeight = true;
+  }
+}
+
+/**
+ * A return's weight does not depend on the value state, and neither does an
+ * indirect call's until it is resolved. A direct call's weight is the root 
+ * priority of the callee's context, which only changes with the key of that
+ * context.
+ */
+void NvmContextDesc::updateAuxWeights(const Value *updated,
+                                      std::vector<WeightChange> &changes) {
+  for (const auto &p : layout->auxInsts) {
+    auto *cb = dyn_cast<CallBase>(p.second);
+    if (!cb || !cb->getCalledFunction()) continue;
+    if (!valueState->updateMayAffectCall(updated, cb)) continue;
+    // As in setCoreWeights, core instructions take precedence.
+    if (isaCoreInst(p.second)) continue;
+
+    uint64_t oldWeight = (*weights)[p.first];
+    uint64_t newWeight = computeAuxInstWeight(p.second);
+    if (newWeight == oldWeight) continue;
+
+    changes.push_back({p.second->getParent(), p.first, oldWeight});
+    setWeight(p.first, newWeight);
   }
 }
 
@@ -589,20 +959,35 @@ NvmContextDesc::Shared NvmContextDesc::tryUpdateContext(Value *v, bool isValNvm)
     
     // First, check the cache.
     ContextCacheKey cck(function, newDesc);
-    if (contextCache.count(cck)) {
-      return contextCache.at(cck);
+    if (NvmContextDesc::Shared cached = contextCache.get(cck)) {
+      return cached;
     }
     // Else, update and add to the cache.
     auto updated = dup();
 
     updated->valueState = newDesc;
-    auto auxInsts = updated->setCoreWeights();
-    if (updated->weights != weights) {
-      updated->setAuxWeights(std::move(auxInsts));
-      updated->setPriorities();
+    std::vector<WeightChange> changes;
+    updated->updateCoreWeights(changes);
+    if (!changes.empty()) {
+      updated->updateAuxWeights(v, changes);
+      updated->updatePriorities(changes);
+
+      // The incremental weights have to agree with computing them all
+      // again. The priorities may not: where a block has several
+      // successors, the last one propagated wins, and the order differs.
+      if (NvmExpensiveChecks) {
+        auto full = dup();
+        full->valueState = newDesc;
+        full->setAuxWeights(full->setCoreWeights());
+        if (*full->weights != *updated->weights ||
+            full->hasCoreWeight != updated->hasCoreWeight) {
+          klee_error("NVM: incremental weights of %s differ from computing "
+                     "them again", function->getName().str().c_str());
+        }
+      }
     }
 
-    contextCache[cck] = updated;
+    contextCache.put(cck, updated);
     return updated;
   }
 
@@ -644,12 +1029,12 @@ NvmHeuristicInfo::~NvmHeuristicInfo() {}
 
 NvmStaticHeuristic::NvmStaticHeuristic(Executor *executor, KFunction *mainFn) 
   : executor_(executor),
-    analysis_(utils::createAndersen(*executor->kmodule->module)),
+    analysis_(NvmAnalysisCache::get(executor->kmodule->module.get())),
     weights_(nullptr),
     priorities_(nullptr),
     curr_(mainFn->function->getEntryBlock().getFirstNonPHIOrDbgOrLifetime()),
     module_(executor->kmodule->module.get()),
-    nvmSites_(utils::getNvmAllocationSites(module_, analysis_)),
+    nvmSites_(analysis_->getNvmAllocationSites()),
     valueState_(NvmValueDesc::staticState(analysis_, module_)) {
 }
 
@@ -672,15 +1057,34 @@ void NvmStaticHeuristic::computePriority(void) {
    */
   resetWeights();
 
+  // These only depend on the module, so they may have been computed already.
+  if (analysis_->getStaticPriorities(*weights_, *priorities_)) return;
+
   std::unordered_set<llvm::CallBase*> call_insts;
 
-  for (Function &f : *module_) {
-    for (BasicBlock &b : f) {
+  // The instruction weights are independent of each other, so they can be
+  // computed per function in parallel.
+  std::vector<Function*> functions;
+  for (Function &f : *module_) functions.push_back(&f);
+
+  std::vector<std::vector<uint64_t> > fnWeights(functions.size());
+  parallelFor(functions.size(), [&](size_t n) {
+    for (BasicBlock &b : *functions[n]) {
+      for (Instruction &i : b) {
+        if (mayHaveWeight(&i)) fnWeights[n].push_back(computeInstWeight(&i));
+      }
+    }
+  });
+
+  for (size_t n = 0; n < functions.size(); ++n) {
+    auto computed = fnWeights[n].begin();
+    for (BasicBlock &b : *functions[n]) {
       for (Instruction &i : b) {
         (*weights_)[&i] = 0lu;
         (*priorities_)[&i] = 0lu;
         if (mayHaveWeight(&i)) {
-          (*weights_)[&i] = computeInstWeight(&i);
+          assert(computed != fnWeights[n].end());
+          (*weights_)[&i] = *computed++;
         } else if (CallBase *cb = dyn_cast<CallBase>(&i)) {
           if (auto *ci = dyn_cast<CallInst>(cb)) {
             if (ci->isInlineAsm()) continue;
@@ -929,7 +1333,8 @@ void NvmStaticHeuristic::computePriority(void) {
 
     }
   } while (changed);
-  
+
+  analysis_->setStaticPriorities(*weights_, *priorities_);
 } 
 
 void NvmStaticHeuristic::dump(void) const {
@@ -941,7 +1346,7 @@ void NvmStaticHeuristic::dump(void) const {
   double pWeights = 100.0 * ((double)nonZeroWeights / (double)weights_->size());
   double pPriorities = 100.0 * ((double)nonZeroPriorities / (double)priorities_->size());
 
-  for (auto *v : utils::getNvmAllocationSites(executor_->kmodule->module.get(), analysis_)) {
+  for (auto *v : analysis_->getNvmAllocationSites()) {
     errs() << *v << "\n";
     assert(valueState_->isNvmAllocCall(dyn_cast<CallInst>(v)));
   }
@@ -959,7 +1364,7 @@ void NvmStaticHeuristic::dump(void) const {
 
 NvmDynamicHeuristic::NvmDynamicHeuristic(Executor *executor,
                                          KFunction *mainFn)
-  : contextDesc(std::make_shared<NvmContextDesc>(utils::createAndersen(*executor->kmodule->module), 
+  : contextDesc(std::make_shared<NvmContextDesc>(NvmAnalysisCache::get(executor->kmodule->module.get()), 
                                                  executor->kmodule->module.get(),
                                                  mainFn->function)),
     curr(mainFn->getKInstruction(mainFn->function->getEntryBlock().getFirstNonPHIOrDbg())) {}
@@ -994,6 +1399,13 @@ void NvmDynamicHeuristic::stepState(ExecutionState *es,
                                     KInstruction *nextPC) {
   TimerStatIncrementer timer(stats::nvmHeuristicTime);
 
+  // Most instructions just move along within the current context.
+  if (!(pc->flags & KInstruction::MayChangeNvmContext) &&
+      contextDesc->function == nextPC->inst->getFunction()) {
+    curr = nextPC;
+    return;
+  }
+
   if (nextPC->inst->getFunction()->getName() == "pthread_exit") return;
 
   if (auto *cb = dyn_cast<CallBase>(pc->inst)) {
@@ -1042,7 +1454,7 @@ void NvmDynamicHeuristic::stepState(ExecutionState *es,
       contextStack.clear();
       callInstStack.clear();
 
-      SharedAndersen sa = contextDesc->andersen;
+      SharedNvmAnalysis sa = contextDesc->analysis;
       Module *m = nextPC->inst->getModule();
       Function *threadMain = nextPC->inst->getFunction();
       contextDesc.reset(new NvmContextDesc(sa, m, threadMain));
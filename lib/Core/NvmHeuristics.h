@@ -28,6 +28,7 @@
 #include <deque>
 #include <memory>
 
+#include "llvm/ADT/Hashing.h"
 #include "llvm/Pass.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Module.h"
@@ -51,6 +52,7 @@
 #include "klee/Internal/Module/KModule.h"
 #include "klee/Internal/Support/ErrorHandling.h"
 
+#include "NvmAnalysisCache.h"
 #include "NvmAnalysisUtils.h"
 #include "Memory.h"
 
@@ -69,7 +71,7 @@ namespace klee {
   class NvmDynamicHeuristic;
   class NvmHeuristicBuilder; // Defined at the end
 
-  typedef std::shared_ptr<AndersenAAWrapperPass> SharedAndersen;
+  typedef std::shared_ptr<NvmAnalysisCache> SharedNvmAnalysis;
 
   /* #region NvmValueDesc */
   /**
@@ -89,25 +91,19 @@ namespace klee {
   class NvmValueDesc : public std::enable_shared_from_this<NvmValueDesc> {
     public:
       typedef std::shared_ptr<NvmValueDesc> Shared;
-      typedef std::unordered_map<const llvm::Value*, 
-                                 std::unordered_set<const llvm::Value*> > AndersenCache;
-      typedef std::shared_ptr<AndersenCache> SharedAndersenCache;
+      typedef std::unordered_set<const llvm::Value*> ValueSet;
+      typedef std::shared_ptr<const ValueSet> SharedValueSet;
     private:
       /**
-       * The shared state.
-       */
-      SharedAndersen andersen_;
-
-      /**
-       * Querying the same value and constructing the set over and over is 
-       * expensive. This cache is helpful.
+       * The shared state. Querying the same value and constructing the set 
+       * over and over is expensive, so this also caches the points-to sets.
        */
-      mutable SharedAndersenCache anders_cache_;
+      SharedNvmAnalysis analysis_;
 
       /**
        * Here we track nvm allocation locations.
        */
-      std::unordered_set<const llvm::Value*> nvm_allocs_;
+      SharedValueSet nvm_allocs_;
 
       /**
        * We conservatively assume that any modification site that points to one
@@ -116,7 +112,28 @@ namespace klee {
        * We count do global and local to avoid propagating unnecessary local 
        * variables when we go to the next context.
        */
-      std::unordered_set<const llvm::Value*> not_local_nvm_, not_global_nvm_;
+      SharedValueSet not_local_nvm_, not_global_nvm_;
+
+      /**
+       * The sets are never modified in place, so descriptions derived from 
+       * one another share them. Each set carries a content hash (the XOR of 
+       * its members' hashes), kept up to date as values are added or removed.
+       */
+      uint64_t allocs_hash_ = 0, local_hash_ = 0, global_hash_ = 0;
+
+      static uint64_t hashValue(const llvm::Value *v) {
+        return (uint64_t)llvm::hash_value(v);
+      }
+      static uint64_t hashSet(const ValueSet &set);
+      static SharedValueSet emptySet(void);
+
+      /**
+       * Copy-on-write insertion and removal. Returns true if the set changed.
+       */
+      static bool insertValue(SharedValueSet &set, uint64_t &hash,
+                              const llvm::Value *v);
+      static bool eraseValue(SharedValueSet &set, uint64_t &hash,
+                             const llvm::Value *v);
 
       /**
        * Each value has a points-to set given by the Andersen alias analysis.
@@ -154,22 +171,18 @@ namespace klee {
        */ 
       // bool varargs_contain_nvm_;
 
-      NvmValueDesc() {}
-      NvmValueDesc(SharedAndersen apa, 
-                   SharedAndersenCache cache,
-                   std::unordered_set<const llvm::Value*> mmap,
-                   std::unordered_set<const llvm::Value*> globals) 
-                   : andersen_(apa),
-                     anders_cache_(cache),
-                     nvm_allocs_(mmap), 
-                     not_global_nvm_(globals) {}
+      NvmValueDesc() 
+        : nvm_allocs_(emptySet()), 
+          not_local_nvm_(emptySet()), 
+          not_global_nvm_(emptySet()) {}
 
     public:
 
       uint64_t hash(void) const {
-        return std::hash<uint64_t>{}((not_local_nvm_.size() << 16) | 
-                                     (not_global_nvm_.size() << 8) |
-                                      nvm_allocs_.size());
+        return allocs_hash_ ^ 
+               llvm::hash_combine(local_hash_, global_hash_, 
+                                  not_local_nvm_->size(), 
+                                  not_global_nvm_->size());
       }
 
       /**
@@ -179,6 +192,14 @@ namespace klee {
        */
       NvmValueDesc::Shared doCall(llvm::CallBase *cb, llvm::Function *f) const;
 
+      /**
+       * Whether updating val (see updateState) may change what doCall 
+       * returns for cb. Only the globals and what the pointer arguments 
+       * point to go into the call.
+       */
+      bool updateMayAffectCall(const llvm::Value *val, 
+                               llvm::CallBase *cb) const;
+
       /** 
        * Set up the value state when doing a return.
        * This essentially just pops the "stack" and propagates the return val.
@@ -203,7 +224,7 @@ namespace klee {
       NvmValueDesc::Shared resolveFunctionPointer(llvm::Function *f);
 
       bool isNvmAllocCall(const llvm::CallBase *cb) const {
-        return !!nvm_allocs_.count(cb);
+        return !!nvm_allocs_->count(cb);
       }
 
       /**
@@ -257,7 +278,7 @@ namespace klee {
       std::string str(void) const;
 
       // Populate with all the calls to mmap.
-      static NvmValueDesc::Shared staticState(SharedAndersen andersen, 
+      static NvmValueDesc::Shared staticState(SharedNvmAnalysis analysis, 
                                               llvm::Module *m);
 
       friend bool operator==(const NvmValueDesc &lhs, const NvmValueDesc &rhs);
@@ -271,7 +292,7 @@ namespace klee {
       typedef std::shared_ptr<NvmContextDesc> Shared;
     private:
       friend class NvmDynamicHeuristic;
-      SharedAndersen andersen;
+      SharedNvmAnalysis analysis;
 
       /**
        * These are the core pieces that define a context.
@@ -304,22 +325,83 @@ namespace klee {
         };
       };
 
-      static std::unordered_map<ContextCacheKey, 
-                                NvmContextDesc::Shared,
-                                ContextCacheKey::Hash> contextCache;
+      /**
+       * Bounded by --nvm-context-cache-size, evicting the least recently used
+       * context first. Evicted contexts live on as long as a state or another
+       * context still refers to them.
+       */
+      class ContextCache {
+        typedef std::list<std::pair<ContextCacheKey, NvmContextDesc::Shared> > 
+          LruList;
+
+        LruList lru;
+        std::unordered_map<ContextCacheKey, 
+                           LruList::iterator, 
+                           ContextCacheKey::Hash> index;
+        bool bounded = true;
+
+        void evict(void);
+
+      public:
+        /// Returns nullptr on a miss.
+        NvmContextDesc::Shared get(const ContextCacheKey &key);
+        void put(const ContextCacheKey &key, NvmContextDesc::Shared ctx);
+        /// Unlike get, neither counts as a hit/miss nor refreshes the entry.
+        bool contains(const ContextCacheKey &key) const {
+          return index.count(key);
+        }
+        /// While unbounded, nothing is evicted. Bounding it again evicts
+        /// what is over the bound.
+        void setBounded(bool b);
+      };
+
+      static ContextCache contextCache;
+
+      /**
+       * Instructions are numbered the way KFunction lays them out, so that 
+       * weights and priorities can be dense tables indexed by 
+       * KInstruction::index. The layout is shared by every context of a 
+       * function.
+       */
+      struct FunctionLayout {
+        /// The indices of the first and last instruction of each block.
+        std::unordered_map<const llvm::BasicBlock*, 
+                           std::pair<unsigned, unsigned> > blocks;
+        unsigned numInstructions;
+        /// The index of the first non-PHI, non-debug entry instruction.
+        unsigned rootIndex;
+        /// The instructions that may be core instructions (stores, flushes
+        /// and fences), and the auxiliary ones, with their indices.
+        std::vector<std::pair<unsigned, llvm::Instruction*> > coreCandidates;
+        std::vector<std::pair<unsigned, llvm::Instruction*> > auxInsts;
+
+        explicit FunctionLayout(llvm::Function *f);
+
+        static std::shared_ptr<const FunctionLayout> get(llvm::Function *f);
+      };
+
+      std::shared_ptr<const FunctionLayout> layout;
+
+      typedef std::vector<uint64_t> Table;
 
       /**
        * This function has a bunch of instructions. They have weights based
        * on the current context.
+       * 
+       * The tables are shared with the contexts dup()'d from this one until
+       * either of them changes its copy.
        */
-      std::unordered_map<llvm::Instruction*, uint64_t> weights;
+      std::shared_ptr<Table> weights;
 
       bool hasCoreWeight = false;
 
       /**
        * This functions's instructions also have a bunch of priorities.
        */
-      std::unordered_map<llvm::Instruction*, uint64_t> priorities;
+      std::shared_ptr<Table> priorities;
+
+      /// Whether the priorities reached the root instruction.
+      bool hasRootPriority = false;
 
       /**
        * CallInsts have succeeding ContextDesc, which is nice to pre-compute
@@ -328,10 +410,17 @@ namespace klee {
 
       /* METHODS */
 
+      /**
+       * Copy the table if it is shared, so it can be changed.
+       */
+      static Table &mutableTable(std::shared_ptr<Table> &table);
+
+      void setWeight(unsigned index, uint64_t weight);
+
       /**
        * Generally used for generating contexts for calls.
        */
-      NvmContextDesc(SharedAndersen anders,
+      NvmContextDesc(SharedNvmAnalysis analysis,
                      llvm::Function *fn,
                      NvmValueDesc::Shared initialArgs,
                      bool parentHasWeight);
@@ -342,6 +431,26 @@ namespace klee {
       uint64_t constructCalledContext(llvm::CallBase *cb, llvm::Function *f);
       uint64_t constructCalledContext(llvm::CallBase *cb);
 
+      /**
+       * Build the contexts of all call sites reachable from this one ahead of
+       * time, on --nvm-heuristic-threads threads, and publish them into the 
+       * context cache. Called contexts are built a wave at a time, as each 
+       * one only needs its caller's core weights. The aux weights and the 
+       * priorities depend on the callees, so they are filled in serially 
+       * afterwards, in a post-order of the calls between the built contexts
+       * so that callees come first. The cache is not bounded meanwhile, so
+       * that no built context is evicted before its callers found it.
+       * 
+       * This context must already have its core weights.
+       */
+      void precomputeCalledContexts(void);
+
+      /**
+       * The (function, value state) keys of the calls this context makes.
+       * Function pointers are resolved at runtime, so they are skipped.
+       */
+      std::vector<ContextCacheKey> calledContextKeys(void) const;
+
       /**
        * Core instructions are instructions that impact NVM
        */
@@ -354,23 +463,48 @@ namespace klee {
        * For this version of the heuristic, this will just be call and return
        * instructions.
        */
-      bool isaAuxInst(llvm::Instruction *i) const;
+      static bool isaAuxInst(llvm::Instruction *i);
       uint64_t computeAuxInstWeight(llvm::Instruction *i);
 
       /**
        * After this, the context should be fully valid.
        */
-      std::list<llvm::Instruction*> setCoreWeights(void);
-      void setAuxWeights(std::list<llvm::Instruction*> auxInsts);
+      typedef std::list<std::pair<unsigned, llvm::Instruction*> > AuxInstList;
+      AuxInstList setCoreWeights(void);
+      void setAuxWeights(AuxInstList auxInsts);
       void setPriorities(void);
 
+      /**
+       * Incremental versions of the above, for when the value state changes.
+       * Only the instructions whose weight changed are reported, and the 
+       * priorities are only propagated up from their blocks.
+       */
+      struct WeightChange {
+        llvm::BasicBlock *block;
+        unsigned index;
+        uint64_t oldWeight;
+      };
+      void updateCoreWeights(std::vector<WeightChange> &changes);
+      /// Only the calls that updating the value may affect are asked again.
+      void updateAuxWeights(const llvm::Value *updated,
+                            std::vector<WeightChange> &changes);
+      void updatePriorities(const std::vector<WeightChange> &changes);
+
+      /**
+       * Propagate priorities up from the given blocks. If incremental, the 
+       * priorities are already valid except around the given blocks, so 
+       * predecessors whose terminator keeps its priority are not revisited.
+       */
+      void propagatePriorities(std::list<llvm::BasicBlock*> toProp,
+                               bool incremental);
+
     public:
 
       /**
        * Constructs the first context, generally for whatever function KLEE is 
        * using for a main function.
        */
-      NvmContextDesc(SharedAndersen anders, llvm::Module *m, llvm::Function *main);
+      NvmContextDesc(SharedNvmAnalysis analysis, llvm::Module *m, llvm::Function *main);
 
       /**
        * Gets the next context if the given PC is a call or return instruction.
@@ -393,14 +527,13 @@ namespace klee {
        * instruction.
        */
       uint64_t getRootPriority(void) const {
-        llvm::Instruction *i = function->getEntryBlock().getFirstNonPHIOrDbg();
-        if (priorities.count(i)) return priorities.at(i);
+        if (hasRootPriority) return (*priorities)[layout->rootIndex];
         
         return hasCoreWeight ? 1lu : 0lu;
       }
 
       uint64_t getPriority(KInstruction *pc) const {
-        return priorities.at(pc->inst);
+        return (*priorities)[pc->index];
       }
 
       NvmContextDesc::Shared dup(void) const {
@@ -476,7 +609,7 @@ namespace klee {
       typedef std::shared_ptr<WeightMap> SharedWeightMap;
 
       Executor *executor_;
-      SharedAndersen analysis_; // Andersen's whole program pointer analysis
+      SharedNvmAnalysis analysis_; // Andersen's whole program pointer analysis
 
       SharedWeightMap weights_;
       SharedWeightMap priorities_;
@@ -598,7 +731,9 @@ namespace klee {
       NvmDynamicHeuristic(Executor *executor, KFunction *mainFn);
 
       virtual void computePriority() override {
-        contextDesc->setAuxWeights(contextDesc->setCoreWeights());
+        auto auxInsts = contextDesc->setCoreWeights();
+        contextDesc->precomputeCalledContexts();
+        contextDesc->setAuxWeights(std::move(auxInsts));
         contextDesc->setPriorities();
       }
 
@@ -628,13 +763,13 @@ namespace klee {
       virtual void dump(void) const override {
         uint64_t nonZeroWeights = 0, nonZeroPriorities = 0;
 
-        for (const auto &p : contextDesc->weights) 
-          nonZeroWeights += (p.second > 0);
-        for (const auto &p : contextDesc->priorities) 
-          nonZeroPriorities += (p.second > 0);
+        for (uint64_t w : *contextDesc->weights) 
+          nonZeroWeights += (w > 0);
+        for (uint64_t p : *contextDesc->priorities) 
+          nonZeroPriorities += (p > 0);
 
-        double pWeights = 100.0 * ((double)nonZeroWeights / (double)contextDesc->weights.size());
-        double pPriorities = 100.0 * ((double)nonZeroPriorities / (double)contextDesc->priorities.size());
+        double pWeights = 100.0 * ((double)nonZeroWeights / (double)contextDesc->weights->size());
+        double pPriorities = 100.0 * ((double)nonZeroPriorities / (double)contextDesc->priorities->size());
 
         llvm::errs() << "NvmContext: \n" << contextDesc->str() << "\n";
         llvm::errs() << "\tCurrent instruction: " << *curr->inst << "\n"; 
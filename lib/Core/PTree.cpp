@@ -31,6 +31,8 @@ void PTree::attach(PTreeNode *node, ExecutionState *leftState, ExecutionState *r
 
 void PTree::remove(PTreeNode *n) {
   assert(!n->left && !n->right);
+  // The root stays, and must not point to a deleted state.
+  n->state = nullptr;
   do {
     PTreeNode *p = n->parent;
     if (p) {
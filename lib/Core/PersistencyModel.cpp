@@ -0,0 +1,76 @@
+//===-- PersistencyModel.cpp ------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "PersistencyModel.h"
+
+#include "klee/Config/Version.h"
+#include "klee/OptionCategories.h"
+
+#include "llvm/Support/CommandLine.h"
+
+using namespace klee;
+
+namespace {
+  enum class PersistencyModelType { ADR, EADR, FencesOnly };
+
+  llvm::cl::opt<PersistencyModelType> PmemModel(
+      "pmem-model",
+      llvm::cl::desc("When writes to persistent memory become durable"),
+      llvm::cl::values(
+          clEnumValN(PersistencyModelType::ADR, "adr",
+                     "Once flushed and fenced (default)"),
+          clEnumValN(PersistencyModelType::EADR, "eadr",
+                     "Immediately, the caches are persistent; flushes and "
+                     "fences are not checked"),
+          clEnumValN(PersistencyModelType::FencesOnly, "fences-only",
+                     "After the next fence, flushed or not; only checks "
+                     "that writes are fenced")
+          KLEE_LLVM_CL_VAL_END),
+      llvm::cl::init(PersistencyModelType::ADR),
+      llvm::cl::cat(CheckerCat));
+
+  class ADRModel : public PersistencyModel {
+  public:
+    const char *getName() const override { return "adr"; }
+    bool tracksWrites() const override { return true; }
+    bool tracksFlushes() const override { return true; }
+    bool fencePersistsWrites() const override { return false; }
+  };
+
+  class EADRModel : public PersistencyModel {
+  public:
+    const char *getName() const override { return "eadr"; }
+    bool tracksWrites() const override { return false; }
+    bool tracksFlushes() const override { return false; }
+    bool fencePersistsWrites() const override { return false; }
+  };
+
+  class FencesOnlyModel : public PersistencyModel {
+  public:
+    const char *getName() const override { return "fences-only"; }
+    bool tracksWrites() const override { return true; }
+    bool tracksFlushes() const override { return false; }
+    bool fencePersistsWrites() const override { return true; }
+  };
+}
+
+const PersistencyModel &PersistencyModel::get() {
+  static const ADRModel adr;
+  static const EADRModel eadr;
+  static const FencesOnlyModel fencesOnly;
+
+  switch (PmemModel) {
+  case PersistencyModelType::EADR:
+    return eadr;
+  case PersistencyModelType::FencesOnly:
+    return fencesOnly;
+  default:
+    return adr;
+  }
+}
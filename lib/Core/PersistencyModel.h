@@ -0,0 +1,49 @@
+//===-- PersistencyModel.h --------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef KLEE_PERSISTENCY_MODEL_H
+#define KLEE_PERSISTENCY_MODEL_H
+
+namespace klee {
+
+  /**
+   * When a write to persistent memory becomes durable. This decides what
+   * PersistentState has to track for each write, and what flushes and 
+   * fences do.
+   *
+   * - ADR: a write is durable once its cache line is flushed and fenced.
+   * - eADR: the caches are in the persistence domain, so a write is durable
+   *   right away. Nothing is tracked, and flushes and fences are no-ops.
+   * - Fences only: a write is durable after the next fence, flushed or not.
+   *   This checks the placement of fences alone.
+   */
+  class PersistencyModel {
+  public:
+    virtual ~PersistencyModel() {}
+
+    virtual const char *getName() const = 0;
+
+    /// Whether a write leaves its cache line unpersisted at all. If not,
+    /// writes are not tracked and fences have nothing to commit.
+    virtual bool tracksWrites() const = 0;
+
+    /// Whether cache line flushes have an effect. If not, they are ignored,
+    /// and never reported as unnecessary.
+    virtual bool tracksFlushes() const = 0;
+
+    /// Whether the next fence persists a write without it being flushed.
+    virtual bool fencePersistsWrites() const = 0;
+
+    /// The model selected with --pmem-model.
+    static const PersistencyModel &get();
+  };
+
+} // End klee namespace
+
+#endif /* KLEE_PERSISTENCY_MODEL_H */
@@ -0,0 +1,146 @@
+//===-- ReplayTree.cpp ------------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "ReplayTree.h"
+
+#include "klee/ExecutionState.h"
+
+#include <algorithm>
+#include <cassert>
+
+using namespace klee;
+
+void ReplayTree::clear() {
+  nodes.assign(1, Node());
+  ids.clear();
+}
+
+unsigned ReplayTree::insert(const DecisionPath &path) {
+  // Up to the first node that is in the tree already, iteratively since
+  // paths can be long.
+  std::vector<DecisionPath> missing;
+  DecisionPath p = path;
+  unsigned node = 0;
+  while (!p.empty()) {
+    auto it = ids.find(p.identity());
+    if (it != ids.end()) {
+      node = it->second;
+      break;
+    }
+    DecisionPath parent = p.parent();
+    missing.push_back(std::move(p));
+    p = std::move(parent);
+  }
+
+  for (auto it = missing.rbegin(), ie = missing.rend(); it != ie; ++it) {
+    // Equal decisions that were recorded separately still share a node.
+    auto child = nodes[node].children.find(it->back());
+    if (child != nodes[node].children.end()) {
+      node = child->second;
+      continue;
+    }
+
+    unsigned id = nodes.size();
+    nodes[node].children[it->back()] = id;
+    nodes.emplace_back();
+    nodes.back().path = *it;
+    // Only while the node keeps the path alive.
+    ids[it->identity()] = id;
+    node = id;
+  }
+  return node;
+}
+
+bool ReplayTree::add(const ReplayPath &path) {
+  assert(positions.empty() && "adding a path to a tree that is replayed");
+  Node &n = nodes[insert(path.decisions)];
+  bool added = !n.end;
+  n.end = true;
+  n.steppedInstructions =
+      std::max(n.steppedInstructions, path.steppedInstructions);
+  return added;
+}
+
+void ReplayTree::start(ExecutionState &state) {
+  positions.emplace(&state, 0);
+  arrive(state);
+}
+
+void ReplayTree::arrive(ExecutionState &state) {
+  auto it = positions.find(&state);
+  if (it == positions.end())
+    return;
+
+  const Node &n = nodes[it->second];
+  if (n.children.empty() &&
+      state.steppedInstructions >= n.steppedInstructions)
+    finish(it);
+}
+
+std::vector<ExecutionState *> ReplayTree::replayingStates() const {
+  std::vector<ExecutionState *> res;
+  for (const auto &position : positions)
+    res.push_back(position.first);
+  return res;
+}
+
+bool ReplayTree::follows(const ExecutionState &state,
+                         unsigned decision) const {
+  auto it = positions.find(const_cast<ExecutionState *>(&state));
+  return it != positions.end() && nodes[it->second].children.count(decision);
+}
+
+void ReplayTree::copy(const ExecutionState &state, ExecutionState &copy) {
+  auto it = positions.find(const_cast<ExecutionState *>(&state));
+  if (it != positions.end())
+    positions[&copy] = it->second;
+}
+
+void ReplayTree::take(ExecutionState &state, unsigned decision) {
+  auto it = positions.find(&state);
+  if (it == positions.end())
+    return;
+
+  const Node &n = nodes[it->second];
+  auto child = n.children.find(decision);
+  assert(child != n.children.end() && "decision is on no replayed path");
+  it->second = child->second;
+  // The instruction that took the decision may be the last one.
+  arrive(state);
+}
+
+void ReplayTree::finish(
+    std::unordered_map<ExecutionState *, unsigned>::iterator it) {
+  positions.erase(it);
+  if (positions.empty())
+    clear();
+}
+
+void ReplayTree::remove(const ExecutionState &state) {
+  auto it = positions.find(const_cast<ExecutionState *>(&state));
+  if (it != positions.end())
+    finish(it);
+}
+
+void ReplayTree::pending(const ExecutionState &state,
+                         std::vector<ReplayPath> &paths) const {
+  auto it = positions.find(const_cast<ExecutionState *>(&state));
+  if (it == positions.end())
+    return;
+
+  std::vector<unsigned> stack(1, it->second);
+  while (!stack.empty()) {
+    const Node &n = nodes[stack.back()];
+    stack.pop_back();
+    if (n.end)
+      paths.push_back({n.path, n.steppedInstructions});
+    for (const auto &child : n.children)
+      stack.push_back(child.second);
+  }
+}
@@ -0,0 +1,101 @@
+//===-- ReplayTree.h --------------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef KLEE_REPLAYTREE_H
+#define KLEE_REPLAYTREE_H
+
+#include "klee/Internal/ADT/DecisionPath.h"
+
+#include <map>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+namespace klee {
+  class ExecutionState;
+
+  /// A state to rebuild by replaying: the decisions that lead to it, and how
+  /// many instructions it had executed (see
+  /// ExecutionState::steppedInstructions). The replay continues past the
+  /// last decision up to there, so the state ends up where it was.
+  struct ReplayPath {
+    DecisionPath decisions;
+    uint64_t steppedInstructions;
+  };
+
+  /// The paths of states that are rebuilt by replaying their decisions (see
+  /// ExecutionState::decisions), merged into a tree. The states that replay
+  /// it only fork where the paths part, so a prefix that many paths share
+  /// is executed once.
+  ///
+  /// A state that reaches the end of its path stops replaying once it has
+  /// executed as many instructions as the state it rebuilds. Once no state
+  /// replays any more, the tree is cleared.
+  class ReplayTree {
+    struct Node {
+      /// By decision.
+      std::map<unsigned, unsigned> children;
+      /// The decisions that lead here, shared with the path of the parent.
+      DecisionPath path;
+      /// Whether an added path ends here, and where it stops then.
+      bool end = false;
+      uint64_t steppedInstructions = 0;
+    };
+
+    /// Node 0 is the empty path.
+    std::vector<Node> nodes;
+    /// The nodes by the identity of their path, see DecisionPath::identity.
+    std::unordered_map<const void *, unsigned> ids;
+    /// The node each replaying state is at.
+    std::unordered_map<ExecutionState *, unsigned> positions;
+
+    unsigned insert(const DecisionPath &path);
+    void finish(std::unordered_map<ExecutionState *, unsigned>::iterator it);
+    void clear();
+
+  public:
+    ReplayTree() { clear(); }
+
+    /// Returns false if the path was added already.
+    bool add(const ReplayPath &path);
+
+    /// Let the state, whose path is empty, replay the tree.
+    void start(ExecutionState &state);
+
+    bool empty() const { return positions.empty(); }
+    /// The state may have been deleted, it is only compared.
+    bool replaying(const ExecutionState *state) const {
+      return positions.count(const_cast<ExecutionState *>(state));
+    }
+    ExecutionState *anyReplaying() const {
+      return positions.empty() ? nullptr : positions.begin()->first;
+    }
+    std::vector<ExecutionState *> replayingStates() const;
+
+    /// Whether a path continues with the decision where the state is.
+    bool follows(const ExecutionState &state, unsigned decision) const;
+
+    /// After a step of the state: stop replaying if it is where its path
+    /// stops.
+    void arrive(ExecutionState &state);
+
+    /// A copy of a replaying state replays from the same point.
+    void copy(const ExecutionState &state, ExecutionState &copy);
+    /// The state took the decision, which a path must continue with. Does
+    /// nothing if the state does not replay.
+    void take(ExecutionState &state, unsigned decision);
+    void remove(const ExecutionState &state);
+
+    /// Adds the paths that the state has left to replay.
+    void pending(const ExecutionState &state,
+                 std::vector<ReplayPath> &paths) const;
+  };
+}
+
+#endif /* KLEE_REPLAYTREE_H */
@@ -11,6 +11,7 @@
 #include <sstream>
 #include <iostream>
 #include <cmath>
+#include <iomanip>
 
 #include "RootCause.h"
 #include "klee/ExecutionState.h"
@@ -18,32 +19,51 @@
 #include "CoreStats.h"
 #include "Executor.h"
 
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/Support/Format.h"
+
 using namespace klee;
 using namespace llvm;
 
 uint64_t RootCauseLocation::Hash::operator()(const RootCauseLocation &r) const {
-  return std::hash<const void*>{}(r.allocSite) ^ 
-         std::hash<const void*>{}(r.inst);
+  uint64_t hash = std::hash<const void*>{}(r.allocSite);
+  hash = (hash * 31) ^ std::hash<const void*>{}(r.inst);
+  hash = (hash * 31) ^ std::hash<const void*>{}(r.stack);
+  return (hash * 31) ^ r.reason;
 }
 
-RootCauseLocation::RootCauseLocation(const ExecutionState &state, 
+RootCauseLocation::RootCauseLocation(const CallStackNode *callStack, 
                                      const llvm::Value *allocationSite, 
                                      const KInstruction *pc,
                                      RootCauseReason r) 
   : allocSite(allocationSite), 
     inst(pc),
+    stack(callStack),
     reason(r) {
   timestamp = time::getUserTime().toMicroseconds() - stats::nvmOfflineTime;
-  for (const klee::StackFrame &sf : state.stack()) {
-    stack.emplace_back(sf.caller, sf.kf);
-  }
 }
 
-void RootCauseLocation::installExampleStackTrace(const ExecutionState &state) {
+std::string RootCauseLocation::stackString(void) const {
   std::string tmp;
   llvm::raw_string_ostream ss(tmp);
-  state.dumpStack(ss);
-  stackStr = ss.str();
+
+  unsigned idx = 0;
+  const KInstruction *target = inst;
+  for (const CallStackNode *sf = stack; sf->parent; sf = sf->parent) {
+    const InstructionInfo &ii = *target->info;
+    ss << "\t#" << idx++;
+    std::stringstream AssStream;
+    AssStream << std::setw(8) << std::setfill('0') << ii.assemblyLine;
+    ss << AssStream.str();
+    ss << " in " << sf->kf->function->getName().str() << " ()";
+    if (ii.file != "")
+      ss << " at " << ii.file << ":" << ii.line;
+    ss << "\n";
+    target = sf->caller;
+  }
+
+  return ss.str();
 }
 
 void RootCauseLocation::addMaskedError(uint64_t id) {
@@ -82,8 +102,7 @@ std::string RootCauseLocation::str(void) const {
     info << " (no allocation info)";
   }
   
-  assert(!stackStr.empty() && "forgot to install string!");
-  info << "\nStack: \n" << stackStr;
+  info << "\nStack: \n" << stackString();
 
   return info.str();
 }
@@ -101,7 +120,7 @@ RootCauseLocation::fullString(const RootCauseManager &mgr) const {
 
     for (auto id : maskedRoots) {
       info << "\tID #" << id << "\n";
-      std::istringstream f(mgr.get(id).stackStr);
+      std::istringstream f(mgr.get(id).stackString());
       std::string line;    
       while (std::getline(f, line)) {
         info << "\t\t" << line << "\n";
@@ -123,6 +142,66 @@ RootCauseLocation::fullString(const RootCauseManager &mgr) const {
   return info.str();
 }
 
+uint64_t RootCauseLocation::fingerprint(void) const {
+  // FNV-1a, so the value does not depend on the standard library.
+  uint64_t hash = 14695981039346656037ull;
+  auto mix = [&hash](const std::string &str) {
+    for (unsigned char c : str) {
+      hash ^= c;
+      hash *= 1099511628211ull;
+    }
+    hash ^= 0xff;
+    hash *= 1099511628211ull;
+  };
+  auto mixLocation = [&mix](const KInstruction *ki, const KFunction *kf) {
+    if (kf) mix(kf->function->getName().str());
+    if (ki) {
+      mix(ki->info->file);
+      mix(std::to_string(ki->info->line));
+      mix(std::to_string(ki->info->assemblyLine));
+    }
+  };
+
+  mix(reasonString());
+  mix(allocSiteString());
+  const KInstruction *target = inst;
+  for (const CallStackNode *sf = stack; sf->parent; sf = sf->parent) {
+    mixLocation(target, sf->kf);
+    target = sf->caller;
+  }
+  if (!stack->parent) mixLocation(target, nullptr);
+
+  return hash;
+}
+
+std::string RootCauseLocation::allocSiteString(void) const {
+  if (!allocSite) return "none";
+
+  std::string str;
+  llvm::raw_string_ostream os(str);
+  if (const Instruction *i = dyn_cast<Instruction>(allocSite)) {
+    const Function *f = i->getParent()->getParent();
+    // The position in the function identifies the site even without debug
+    // information.
+    unsigned index = 0;
+    for (const Instruction &other : instructions(f)) {
+      if (&other == i) break;
+      ++index;
+    }
+    os << f->getName() << "()#" << index;
+    if (const DILocation *loc = i->getDebugLoc().get())
+      os << " at " << loc->getFilename() << ":" << loc->getLine();
+  } else if (const Argument *arg = dyn_cast<Argument>(allocSite)) {
+    os << arg->getParent()->getName() << "():arg" << arg->getArgNo();
+  } else if (const GlobalValue *gv = dyn_cast<GlobalValue>(allocSite)) {
+    os << "global:" << gv->getName();
+  } else {
+    os << "value";
+  }
+
+  return os.str();
+}
+
 const char *RootCauseLocation::reasonString(void) const {
   switch(reason) {
     case PM_Unpersisted:
@@ -156,39 +235,44 @@ bool klee::operator==(const RootCauseLocation &lhs,
 
 /***/
 
-/**
- * This doesn't work as well as I would hope, but it should be at least better.
- */
-uint64_t 
-RootCauseManager::getNewId(const ExecutionState &state, 
-                           const RootCauseLocation &rcl) {
-  uint64_t id = std::hash<std::string>{}(rcl.stackStr);
-  id = std::hash<uint64_t>{}(id ^ state.stateTime);
-  while (usedIds.count(id)) {
-    klee_warning_once(0, "Had to increment ID! Root cause tracking across runs "
-                         "may now be annoying!");
-    ++id;
+const CallStackNode *
+RootCauseManager::getCallStack(const ExecutionState &state) {
+  const auto &frames = state.stack();
+
+  // The frames below a frame never change while it is live, so start from 
+  // the innermost frame whose node is already known.
+  size_t i = frames.size();
+  while (i > 0 && !frames[i - 1].callStack) --i;
+  CallStackNode *node = i ? frames[i - 1].callStack : &stackRoot;
+
+  for (; i < frames.size(); ++i) {
+    const StackFrame &sf = frames[i];
+    const KInstruction *caller = sf.caller;
+    auto &child = node->children[std::make_pair(caller, sf.kf)];
+    if (!child) {
+      child.reset(new CallStackNode(node, caller, sf.kf));
+    }
+    node = child.get();
+    sf.callStack = node;
   }
-  usedIds.insert(id);
 
-  return id;
-} 
+  return node;
+}
 
 uint64_t 
 RootCauseManager::getRootCauseLocationID(const ExecutionState &state, 
                                          const llvm::Value *allocationSite, 
                                          const KInstruction *pc,
                                          RootCauseReason reason) {
-  RootCauseLocation rcl(state, allocationSite, pc, reason);
+  RootCauseLocation rcl(getCallStack(state), allocationSite, pc, reason);
 
   if (rootToId.count(rcl)) {
     return rootToId.at(rcl);
   }
 
   auto uniqRcl = std::unique_ptr<RootCauseInfo>(new RootCauseInfo(rcl));
-  uniqRcl->rootCause.installExampleStackTrace(state);
 
-  uint64_t newId = getNewId(state, uniqRcl->rootCause);
+  uint64_t newId = getNewId();
 
   rootToId[rcl] = newId;
   idToRoot[newId] = std::move(uniqRcl);
@@ -216,16 +300,15 @@ RootCauseManager::getRootCauseLocationID(const ExecutionState &state,
                                          const KInstruction *pc,
                                          RootCauseReason reason,
                                          const std::unordered_set<uint64_t> &ids) {
-  RootCauseLocation rcl(state, allocationSite, pc, reason);
+  RootCauseLocation rcl(getCallStack(state), allocationSite, pc, reason);
 
   if (rootToId.count(rcl)) {
     return rootToId.at(rcl);
   }
 
   auto uniqRcl = std::unique_ptr<RootCauseInfo>(new RootCauseInfo(rcl));
-  uniqRcl->rootCause.installExampleStackTrace(state);
 
-  uint64_t newId = getNewId(state, uniqRcl->rootCause);
+  uint64_t newId = getNewId();
 
   /**
    * We want all the ids so we can flatten the masking set (i.e., the masking 
@@ -273,11 +356,42 @@ RootCauseManager::getRootCauseLocationID(const ExecutionState &state,
   return newId;
 }
 
+uint64_t 
+RootCauseManager::getDeferredRootCauseLocationID(const ExecutionState &state, 
+                                                 const CallStackNode *callStack,
+                                                 const llvm::Value *allocationSite, 
+                                                 const KInstruction *pc,
+                                                 RootCauseReason reason,
+                                                 const std::unordered_set<uint64_t> &ids) {
+  RootCauseLocation rcl(callStack, allocationSite, pc, reason);
+
+  if (rootToId.count(rcl)) {
+    return rootToId.at(rcl);
+  }
+
+  auto uniqRcl = std::unique_ptr<RootCauseInfo>(new RootCauseInfo(rcl));
+
+  uint64_t newId = getNewId();
+
+  for (auto id : getAllMaskedIDs(ids)) {
+    assert(idToRoot.count(id) && "we messed something up with our id tracking");
+    uniqRcl->rootCause.addMaskedError(id);
+    idToRoot.at(id)->rootCause.addMaskingError(newId);
+  }
+
+  rootToId[rcl] = newId;
+  idToRoot[newId] = std::move(uniqRcl);
+
+  return newId;
+}
+
 void RootCauseManager::markAsBug(uint64_t id) {
   if (!idToRoot.count(id)) {
     klee_error("ID %lu is not in our mappings!", id);
   }
 
+  if (!counting) return;
+
   std::unordered_set<uint64_t> allIds(idToRoot.at(id)->rootCause.getMaskedSet());
   allIds.insert(id);
 
@@ -310,7 +424,7 @@ void RootCauseManager::markAsBug(uint64_t id) {
     buggyIds.insert(i);
     assert(totalOccurences > 0 && "overflow!");
     // We use this for the number of rows later
-    largestStack = std::max(largestStack, idToRoot[i]->rootCause.stack.size());
+    largestStack = std::max(largestStack, idToRoot[i]->rootCause.stack->depth);
   }
 }
 
@@ -344,6 +458,8 @@ void RootCauseManager::dumpText(llvm::raw_ostream &out) const {
 
   for (const auto &id : buggyIds) {
     out << "\n(" << bugNo << ") ID #" << id; 
+    out << " [" << llvm::format_hex(idToRoot.at(id)->rootCause.fingerprint(), 18) 
+        << "]";
     out << " with " << idToRoot.at(id)->occurences << " occurences:\n";
     out << idToRoot.at(id)->rootCause.fullString(*this);
     bugNo++;
@@ -354,7 +470,7 @@ void RootCauseManager::dumpText(llvm::raw_ostream &out) const {
 
 void RootCauseManager::dumpCSV(llvm::raw_ostream &out) const {
   // Create header
-  out << "ID,Timestamp,Type,Occurences";
+  out << "ID,Fingerprint,Timestamp,Type,Occurences";
   for (size_t stackframeNum = 0; stackframeNum < largestStack; ++stackframeNum) {
     // This is the full description as a convenience
     out << ",StackFrame" << stackframeNum << ",";
@@ -370,15 +486,15 @@ void RootCauseManager::dumpCSV(llvm::raw_ostream &out) const {
   for (const auto &id : buggyIds) {
     RootCauseLocation &rcl = idToRoot.at(id)->rootCause;
     out << id << ","; // ID
+    out << llvm::format_hex(rcl.fingerprint(), 18) << ","; // Fingerprint
     out << rcl.timestamp << ","; // Timestamp (microseconds)
     out << rcl.reasonString() << ","; // Type
     out << idToRoot.at(id)->occurences; // Occurences
 
     const KInstruction *target = rcl.inst;
-    assert(largestStack >= rcl.stack.size() && "bad tracking!");
-    for (auto it = rcl.stack.rbegin(); it != rcl.stack.rend(); ++it) {
-      RootCauseLocation::RootCauseStackFrame &sf = *it;
-      Function *f = sf.kf->function;
+    assert(largestStack >= rcl.stack->depth && "bad tracking!");
+    for (const CallStackNode *sf = rcl.stack; sf->parent; sf = sf->parent) {
+      Function *f = sf->kf->function;
       const InstructionInfo &ii = *target->info;
 
       out << ",";
@@ -394,7 +510,7 @@ void RootCauseManager::dumpCSV(llvm::raw_ostream &out) const {
       out << ii.file << ",";
       out << ii.line; // Next iteration writes the comma
 
-      target = sf.caller;
+      target = sf->caller;
     }    
     
     out << "\n"; // Entry complete
@@ -403,6 +519,211 @@ void RootCauseManager::dumpCSV(llvm::raw_ostream &out) const {
   out.flush();
 }
 
+/**
+ * Fields are separated by tabs, so those (and line breaks) are escaped.
+ */
+static std::string escapeField(const std::string &str) {
+  std::string res;
+  for (char c : str) {
+    switch (c) {
+      case '\\': res += "\\\\"; break;
+      case '\t': res += "\\t"; break;
+      case '\n': res += "\\n"; break;
+      default: res += c; break;
+    }
+  }
+  return res;
+}
+
+/**
+ * The format is line-based, with tab-separated fields:
+ *    klee-root-cause-db <version>
+ *    run <name> <number of bugs>
+ *    rc <fingerprint> <type> <occurences> <timestamp> <allocation site>
+ *       <fingerprints of masked root causes, or -> <frame>...
+ * Every dump starts with the header, so appending a dump to a database (or
+ * concatenating databases) gives a valid database.
+ */
+void RootCauseManager::dumpDatabase(llvm::raw_ostream &out,
+                                   const std::string &run) const {
+  std::vector<std::pair<uint64_t, uint64_t> > bugs;
+  for (const auto &id : buggyIds) {
+    uint64_t occurences = idToRoot.at(id)->occurences;
+    auto it = excludedOccurences.find(id);
+    if (it != excludedOccurences.end()) occurences -= it->second;
+    if (occurences) bugs.emplace_back(id, occurences);
+  }
+
+  out << "klee-root-cause-db\t1\n";
+  out << "run\t" << escapeField(run) << "\t" << bugs.size() << "\n";
+
+  for (const auto &bug : bugs) {
+    const RootCauseInfo &info = *idToRoot.at(bug.first);
+    const RootCauseLocation &rcl = info.rootCause;
+
+    out << "rc\t" << llvm::format_hex(rcl.fingerprint(), 18)
+        << "\t" << rcl.reasonString()
+        << "\t" << bug.second
+        << "\t" << rcl.timestamp
+        << "\t" << escapeField(rcl.allocSiteString()) << "\t";
+
+    if (rcl.maskedRoots.empty()) {
+      out << "-";
+    } else {
+      bool first = true;
+      for (uint64_t masked : rcl.maskedRoots) {
+        if (!first) out << ",";
+        out << llvm::format_hex(get(masked).fingerprint(), 18);
+        first = false;
+      }
+    }
+
+    const KInstruction *target = rcl.inst;
+    for (const CallStackNode *sf = rcl.stack; sf->parent; sf = sf->parent) {
+      const InstructionInfo &ii = *target->info;
+      std::string frame = sf->kf->function->getName().str() + "()";
+      if (ii.file != "")
+        frame += " at " + ii.file + ":" + std::to_string(ii.line);
+      out << "\t" << escapeField(frame);
+      target = sf->caller;
+    }
+
+    out << "\n";
+  }
+
+  out.flush();
+}
+
+void RootCauseManager::excludeFromDatabase(void) {
+  for (const auto &id : buggyIds) {
+    excludedOccurences[id] = idToRoot.at(id)->occurences;
+  }
+}
+
+uint64_t RootCauseCodec::encode(const llvm::Value *v) const {
+  return reinterpret_cast<uintptr_t>(v);
+}
+
+uint64_t RootCauseCodec::encode(const KInstruction *ki) const {
+  return reinterpret_cast<uintptr_t>(ki);
+}
+
+uint64_t RootCauseCodec::encode(const KFunction *kf) const {
+  return reinterpret_cast<uintptr_t>(kf);
+}
+
+const llvm::Value *RootCauseCodec::decodeValue(uint64_t id) const {
+  return reinterpret_cast<const llvm::Value*>(id);
+}
+
+const KInstruction *RootCauseCodec::decodeInstruction(uint64_t id) const {
+  return reinterpret_cast<const KInstruction*>(id);
+}
+
+KFunction *RootCauseCodec::decodeFunction(uint64_t id) const {
+  return reinterpret_cast<KFunction*>(id);
+}
+
+void RootCauseManager::serialize(std::vector<std::string> &lines,
+                                 const RootCauseCodec &codec) const {
+  for (uint64_t id = 1; id < nextId; ++id) {
+    auto it = idToRoot.find(id);
+    if (it == idToRoot.end()) continue;
+    const RootCauseLocation &rcl = it->second->rootCause;
+
+    std::vector<const CallStackNode*> frames;
+    for (const CallStackNode *sf = rcl.stack; sf->parent; sf = sf->parent)
+      frames.push_back(sf);
+
+    std::ostringstream os;
+    os << "rc " << id << " " << rcl.reason << " "
+       << codec.encode(rcl.allocSite) << " " << codec.encode(rcl.inst) << " "
+       << rcl.timestamp << " " << it->second->occurences << " "
+       << frames.size();
+    // Outermost frame first, as the trie is built.
+    for (auto fi = frames.rbegin(), fe = frames.rend(); fi != fe; ++fi) {
+      os << " " << codec.encode((*fi)->caller)
+         << " " << codec.encode((*fi)->kf);
+    }
+    os << " " << rcl.maskedRoots.size();
+    for (uint64_t masked : rcl.maskedRoots) os << " " << masked;
+
+    lines.push_back(os.str());
+  }
+}
+
+bool RootCauseManager::merge(const std::string &line,
+                             std::unordered_map<uint64_t, uint64_t> &idMap,
+                             const RootCauseCodec &codec) {
+  std::istringstream is(line);
+  std::string tag;
+  uint64_t id, timestamp, occurences, allocSiteId, instId;
+  unsigned reason;
+  size_t depth;
+  if (!(is >> tag >> id >> reason >> allocSiteId >> instId >> timestamp
+           >> occurences >> depth) || tag != "rc" ||
+      reason > PM_SemanticCorrectness)
+    return false;
+
+  const llvm::Value *allocSite = codec.decodeValue(allocSiteId);
+  const KInstruction *inst = codec.decodeInstruction(instId);
+  if ((allocSiteId && !allocSite) || !inst) return false;
+
+  CallStackNode *node = &stackRoot;
+  for (size_t i = 0; i < depth; ++i) {
+    uint64_t callerId, kfId;
+    if (!(is >> callerId >> kfId)) return false;
+
+    const KInstruction *caller = codec.decodeInstruction(callerId);
+    KFunction *kf = codec.decodeFunction(kfId);
+    if ((callerId && !caller) || !kf) return false;
+
+    auto key = std::make_pair(caller, static_cast<const KFunction*>(kf));
+    auto &child = node->children[key];
+    if (!child) child.reset(new CallStackNode(node, caller, kf));
+    node = child.get();
+  }
+
+  RootCauseLocation rcl(node, allocSite, inst,
+                        static_cast<RootCauseReason>(reason));
+  rcl.timestamp = timestamp;
+
+  uint64_t mergedId;
+  auto it = rootToId.find(rcl);
+  if (it != rootToId.end()) {
+    mergedId = it->second;
+  } else {
+    mergedId = getNewId();
+    rootToId[rcl] = mergedId;
+    idToRoot[mergedId].reset(new RootCauseInfo(rcl));
+  }
+  idMap[id] = mergedId;
+
+  RootCauseInfo &info = *idToRoot.at(mergedId);
+  info.rootCause.timestamp = std::min(info.rootCause.timestamp, timestamp);
+
+  size_t numMasked;
+  if (!(is >> numMasked)) return false;
+  for (size_t i = 0; i < numMasked; ++i) {
+    uint64_t masked;
+    if (!(is >> masked)) return false;
+    // Masked root causes always come first.
+    auto mit = idMap.find(masked);
+    if (mit == idMap.end()) continue;
+    info.rootCause.addMaskedError(mit->second);
+    idToRoot.at(mit->second)->rootCause.addMaskingError(mergedId);
+  }
+
+  if (occurences) {
+    info.occurences += occurences;
+    totalOccurences += occurences;
+    buggyIds.insert(mergedId);
+    largestStack = std::max(largestStack, node->depth);
+  }
+
+  return true;
+}
+
 std::string RootCauseManager::getSummary(void) const {
   std::string infoStr;
   llvm::raw_string_ostream info(infoStr);
@@ -11,10 +11,13 @@
 #define KLEE_ROOT_CAUSE_H
 
 #include <list>
+#include <map>
+#include <memory>
 #include <stdint.h>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include "llvm/Pass.h"
 #include "llvm/IR/Function.h"
@@ -45,38 +48,40 @@ namespace klee {
     PM_SemanticCorrectness
   };
 
+  /**
+   * A call stack, interned in the trie of the RootCauseManager. A node is the
+   * innermost frame of a stack and its parent is the stack of the caller, so
+   * equal stacks are the same node.
+   */
+  struct CallStackNode {
+    typedef std::map<std::pair<const KInstruction *, const KFunction *>,
+                     std::unique_ptr<CallStackNode> > children_ty;
+
+    const CallStackNode *parent;
+    /// The call instruction in the caller, null for the first frame.
+    const KInstruction *caller;
+    KFunction *kf;
+    /// Number of frames, the root of the trie is the empty stack.
+    size_t depth;
+    children_ty children;
+
+    CallStackNode(const CallStackNode *p, const KInstruction *c, KFunction *f)
+      : parent(p), caller(c), kf(f), depth(p ? p->depth + 1 : 0) {}
+  };
+
   struct RootCauseLocation {
     struct Hash {
       uint64_t operator()(const RootCauseLocation &) const;
     };
 
-    struct RootCauseStackFrame {
-      KInstIterator caller;
-      KFunction *kf;
-
-      RootCauseStackFrame(const KInstIterator &c, KFunction *f)
-        : caller(c), kf(f) {}
-      
-      bool operator==(const RootCauseStackFrame &other) const {
-        return caller == other.caller && kf == other.kf;
-      }
-    };
-
     const llvm::Value *allocSite;
     const KInstruction *inst;
-    std::list<RootCauseStackFrame> stack;
+    const CallStackNode *stack;
     RootCauseReason reason;
 
     // So we can track when this bug occurred.
     uint64_t timestamp;
 
-    /**
-     * We maintain our own stack to check the absolute location,
-     * but the stack description from ExecutionState contains argument values
-     * which can be helpful for debugging.
-     */
-    std::string stackStr;
-
     /**
      * Sometimes, one error may mask another. We want to record the chain
      * of root causes that may be the original error.
@@ -85,7 +90,7 @@ namespace klee {
     std::unordered_set<uint64_t> maskingRoots;
 
 
-    RootCauseLocation(const ExecutionState &state,
+    RootCauseLocation(const CallStackNode *callStack,
                       const llvm::Value *allocationSite, 
                       const KInstruction *pc,
                       RootCauseReason r);
@@ -97,10 +102,28 @@ namespace klee {
 
     std::string str(void) const;
 
-    void installExampleStackTrace(const ExecutionState &state);
+    /**
+     * Render the stack in the format of ExecutionState::dumpStack (without
+     * argument values). Only done when the root cause is written out.
+     */
+    std::string stackString(void) const;
 
     std::string fullString(const RootCauseManager &mgr) const;
 
+    /**
+     * IDs are only meaningful within a run. The fingerprint identifies the
+     * same root cause across runs, as it only depends on the reason, the
+     * source locations of the instruction and its call stack, and where the
+     * object was allocated.
+     */
+    uint64_t fingerprint(void) const;
+
+    /**
+     * A description of the allocation site that does not depend on the
+     * addresses of this run.
+     */
+    std::string allocSiteString(void) const;
+
     const char *reasonString(void) const;
 
     RootCauseReason getReason(void) const { return reason; }
@@ -109,12 +132,34 @@ namespace klee {
                             const RootCauseLocation &rhs);
   };
 
+  /**
+   * How serialized root causes refer to the module. The default writes the
+   * pointers themselves, which only mean the same thing in the process and
+   * its forks. Null pointers are always encoded as 0.
+   */
+  class RootCauseCodec {
+    public:
+      virtual ~RootCauseCodec() {}
+
+      virtual uint64_t encode(const llvm::Value *v) const;
+      virtual uint64_t encode(const KInstruction *ki) const;
+      virtual uint64_t encode(const KFunction *kf) const;
+
+      /// These return null for an unknown ID.
+      virtual const llvm::Value *decodeValue(uint64_t id) const;
+      virtual const KInstruction *decodeInstruction(uint64_t id) const;
+      virtual KFunction *decodeFunction(uint64_t id) const;
+  };
+
   /**
    * 
    */
   class RootCauseManager {
     private:
-      std::unordered_set<uint64_t> usedIds;
+      /**
+       * IDs are handed out densely, starting at 1 (0 means "no root cause").
+       */
+      uint64_t nextId = 1;
 
       struct RootCauseInfo {
         RootCauseLocation rootCause;
@@ -132,16 +177,24 @@ namespace klee {
 
       size_t largestStack = 0;
 
+      bool counting = true;
+
+      /**
+       * The occurences that dumpDatabase leaves out, see excludeFromDatabase.
+       */
+      std::unordered_map<uint64_t, uint64_t> excludedOccurences;
+
       /**
-       * So IDs will be (mostly) deterministic.
+       * The trie of call stacks, rooted at the empty stack.
        */
-      uint64_t getNewId(const ExecutionState &state, 
-                        const RootCauseLocation &rcl);
+      CallStackNode stackRoot;
+
+      uint64_t getNewId() { return nextId++; }
 
       std::unordered_set<uint64_t> getAllMaskedIDs(const std::unordered_set<uint64_t> &ids);
 
     public:
-      RootCauseManager() {}
+      RootCauseManager() : stackRoot(nullptr, nullptr, nullptr) {}
 
       uint64_t getRootCauseLocationID(const ExecutionState &state, 
                                       const llvm::Value *allocationSite, 
@@ -154,6 +207,23 @@ namespace klee {
                                       RootCauseReason r, 
                                       const std::unordered_set<uint64_t> &ids);
 
+
+      /**
+       * Intern the call stack of the current thread of the state. The node of
+       * each frame is cached in the frame, so this is usually a lookup.
+       */
+      const CallStackNode *getCallStack(const ExecutionState &state);
+
+      /**
+       * For deferred attribution, where the root cause is reconstructed long
+       * after the state has left the stack it was created on.
+       */
+      uint64_t getDeferredRootCauseLocationID(const ExecutionState &state,
+                                              const CallStackNode *callStack,
+                                              const llvm::Value *allocationSite,
+                                              const KInstruction *pc,
+                                              RootCauseReason r,
+                                              const std::unordered_set<uint64_t> &ids);
       
       void markAsBug(uint64_t id);
 
@@ -166,6 +236,41 @@ namespace klee {
       void dumpCSV(llvm::raw_ostream &out) const;
       void dumpText(llvm::raw_ostream &out) const;
 
+      /**
+       * Write the bugs in the root-cause database format, which many runs
+       * can append to the same file, and klee-pmem-merge deduplicates by
+       * fingerprint. run names the run the bugs come from.
+       */
+      void dumpDatabase(llvm::raw_ostream &out, const std::string &run) const;
+
+      /**
+       * Leave the occurences counted so far out of dumpDatabase. For an
+       * exploration worker, whose parent already reports the bugs found 
+       * before the fork.
+       */
+      void excludeFromDatabase(void);
+
+      /**
+       * Exploration workers are forks of the coordinator, so the module
+       * pointers in a root cause mean the same thing in every process. A
+       * worker sends all its root causes as lines of text, in ID order, and
+       * the coordinator merges them into its own. idMap maps the worker's
+       * IDs to the merged ones. Checkpoints pass a codec that works across
+       * runs instead.
+       */
+      void serialize(std::vector<std::string> &lines,
+                     const RootCauseCodec &codec = RootCauseCodec()) const;
+      bool merge(const std::string &line,
+                 std::unordered_map<uint64_t, uint64_t> &idMap,
+                 const RootCauseCodec &codec = RootCauseCodec());
+
+      /**
+       * While set, bugs are not counted again. For a resumed run, whose
+       * replay of the frontier passes the bugs the checkpoint already
+       * counted.
+       */
+      void setCounting(bool value) { counting = value; }
+
       void clear();
 
       std::string getSummary(void) const;
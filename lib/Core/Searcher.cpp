@@ -304,7 +304,7 @@ bool RandomPathSearcher::empty() {
 
 
 bool NvmPathSearcher::StatePriority::operator<(const NvmPathSearcher::StatePriority &other) const {
-  bool youngerState = state->steppedInstructions < other.state->steppedInstructions;
+  bool youngerState = steppedInstructions < other.steppedInstructions;
   bool higherGen = generation > other.generation;
   bool equalGen = generation == other.generation;
   bool lowerPriority = priority < other.priority;
@@ -321,24 +321,12 @@ NvmPathSearcher::NvmPathSearcher(Executor &_executor)
 
 NvmPathSearcher::~NvmPathSearcher() {}
 
-ExecutionState* NvmPathSearcher::filterState(ExecutionState *execState) {
-  const auto iter = removed.find(execState);
-  if (iter != removed.end()) {
-    removed.erase(iter);
-    return nullptr;
-  }
-
-  return execState;
-}
-
 ExecutionState &NvmPathSearcher::selectState() {
- 
-  do {
-    const auto &sp = statePriorities.top();
-    lastState = filterState(sp.state);
-    currentGen = sp.generation;
-    statePriorities.pop();
-  } while (!lastState);
+  assert(!statePriorities.empty() && "no state to select");
+
+  // The state stays queued; update re-keys it once it has stepped.
+  lastState = statePriorities.top();
+  currentGen = statePriorities.topKey().generation;
 
   return *lastState;
 }
@@ -366,7 +354,9 @@ void NvmPathSearcher::addState(ExecutionState *current,
 
   size_t priority = execState->nvmInfo()->getCurrentPriority();
 
-  statePriorities.emplace(execState, gen, priority);
+  statePriorities.insert(execState, 
+                         StatePriority(gen, priority, 
+                                       execState->steppedInstructions));
 }
 
 void
@@ -375,7 +365,7 @@ NvmPathSearcher::update(ExecutionState *current,
                         const std::vector<ExecutionState *> &removedStates)
 {
  
-  // Re-insert the current state with a new priority.
+  // Update the current state with its new priority.
   if (current) {
     addState(nullptr, current);
   }
@@ -384,8 +374,9 @@ NvmPathSearcher::update(ExecutionState *current,
     addState(current, execState);
   }
 
-  // We will filter when we re-select.
-  removed.insert(removedStates.begin(), removedStates.end());
+  for (ExecutionState *execState : removedStates) {
+    statePriorities.remove(execState);
+  }
 }
 
 bool NvmPathSearcher::empty() {
@@ -10,6 +10,7 @@
 #ifndef KLEE_SEARCHER_H
 #define KLEE_SEARCHER_H
 
+#include "klee/Internal/ADT/IndexedHeap.h"
 #include "klee/Internal/System/Time.h"
 #include "../Module/Passes.h"
 
@@ -222,9 +223,10 @@ namespace klee {
   class NvmPathSearcher : public Searcher {
     /**
      * The three fields are:
-     * 1. The execution state. Naturally.
-     * 2. The generation of the execution state.
-     * 3. The priority of the execution state.
+     * 1. The generation of the execution state.
+     * 2. The priority of the execution state.
+     * 3. How many instructions the state had stepped, to break ties. This is
+     *    a snapshot, as the heap order must not change behind its back.
      *
      * The "generation" is a way to prioritize coverage. If we fork some state,
      * and it has a common post-dominator with the same successors, it is likely
@@ -232,12 +234,12 @@ namespace klee {
      * is over.
      */
     struct StatePriority {
-      ExecutionState *state;
       size_t generation;
       size_t priority;
+      uint64_t steppedInstructions;
 
-      StatePriority(ExecutionState *s, size_t g, size_t p) :
-          state(s), generation(g), priority(p) {}
+      StatePriority(size_t g, size_t p, uint64_t s) :
+          generation(g), priority(p), steppedInstructions(s) {}
       /**
        * Determine if LHS < RHS
        * If the generation of rhs is higher, it has lower priority. If it has
@@ -252,25 +254,23 @@ namespace klee {
      */
     size_t currentGen = 0;
 
-    std::priority_queue<StatePriority> statePriorities;
+    /**
+     * One entry per live state, re-keyed as the state steps and removed as
+     * soon as the state is.
+     */
+    IndexedHeap<ExecutionState*, StatePriority> statePriorities;
 
-    std::unordered_set<ExecutionState*> removed;
     ExecutionState *lastState;
 
     std::unordered_map<ExecutionState*, bool> generateTest;
     std::unordered_set<const llvm::BasicBlock*> covered;
 
     /**
-     * Add execState to the queue. current used for generation calc.
+     * Add execState to the queue, or update its priority if it is already 
+     * queued. current used for generation calc.
      */
     void addState(ExecutionState *current, ExecutionState *execState);
 
-    /**
-     * Removes removed states from the queue only if they are selected as the 
-     * next state to run. Lazy removal.
-     */
-    ExecutionState* filterState(ExecutionState *);
-
     /**
      * Given the current state, see if a newly added state should go in a second
      * generation.
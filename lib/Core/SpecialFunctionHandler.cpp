@@ -161,6 +161,8 @@ static SpecialFunctionHandler::HandlerInfo handlerInfo[] = {
   add("klee_pmem_alloc_pmem", handleAllocPmem, true),
   add("klee_pmem_mark_persistent", handleMarkPersistent, true),
   add("klee_pmem_check_persisted", handleIsPersisted, false),
+  add("klee_pmem_flush_range", handleFlushRange, false),
+  add("klee_pmem_persist_range", handlePersistRange, false),
   add("klee_pmem_check_ordered_before", handleIsOrderedBefore, false),
   add("klee_pmem_is_pmem", handleIsPmem, true),
 
@@ -918,20 +920,7 @@ void SpecialFunctionHandler::handleInitConcreteZero(ExecutionState &state,
     klee_error("Not sure how to handle symbolic size argument yet!");
   }
 
-  std::list<ObjectPair> pmemObjs;
-  uint64_t offset = 0;
-  for (; offset < realSize; offset += PersistentState::MaxSize) {
-    ref<Expr> offsetExpr = ConstantExpr::create(offset, Expr::Int64);
-    ref<Expr> ptrExpr = AddExpr::create(addr, offsetExpr);
-    
-    ObjectPair res;
-    bool success;
-    assert(state.addressSpace.resolveOne(state, executor.solver, 
-                                         ptrExpr, res, success));
-    assert(success && "could not resolve one! (isPmem)");
-    assert(isa<PersistentState>(res.second) && "should not use this on others");
-    pmemObjs.push_back(res);
-  }
+  std::list<ObjectPair> pmemObjs = getPmemObjsInRange(state, addr, realSize);
   
   for (ObjectPair &op : pmemObjs) {
     const ObjectState *cos = state.addressSpace.findObject(op.first);
@@ -955,12 +944,7 @@ void SpecialFunctionHandler::handleUndefineFixedObject(ExecutionState &state,
 
   for (Executor::ExactResolutionList::iterator it = rl.begin(), ie = rl.end(); 
           it != ie; ++it) {
-    const MemoryObject *mo = it->first.first;
-    if (state.persistentObjects.count(mo)) {
-      state.persistentObjects.erase(mo);
-    }
-
-    it->second->addressSpace.unbindObject(it->first.first);
+    it->second->unbindObject(it->first.first);
   }
 }
 
@@ -1076,6 +1060,12 @@ void SpecialFunctionHandler::doAllocContiguous(ExecutionState &state,
                             unitSz, nObj, false, true, state.prevPC()->inst);
   int objNum = 0;
 
+  if (make_persistent && !mos.empty()) {
+    std::vector<const MemoryObject *> chunks(mos.begin(), mos.end());
+    state.persistentRegions[chunks.front()->address] = 
+      std::make_shared<const PersistentRegion>(chunks);
+  }
+
   int fd = -1;
   if (!file_name.empty()) {
     fd = open(file_name.c_str(), O_RDONLY);
@@ -1148,6 +1138,27 @@ SpecialFunctionHandler::getPmemObjsInRange(ExecutionState &state,
                                            ref<Expr> addr,
                                            uint64_t realSize) {
   std::list<ObjectPair> pmemObjs;
+
+  // Fast path: the whole range lies in one klee_pmem_alloc_pmem mapping, so
+  // the chunks can be looked up directly instead of asking the solver.
+  if (ConstantExpr *CE = dyn_cast<ConstantExpr>(addr)) {
+    uint64_t start = CE->getZExtValue();
+    const PersistentRegion *region = state.findPersistentRegion(start);
+    if (region && realSize && region->contains(start + realSize - 1)) {
+      uint64_t chunkAddr = start - (start - region->address) % region->chunkSize;
+      for (; chunkAddr < start + realSize; chunkAddr += region->chunkSize) {
+        const MemoryObject *mo = region->getChunk(chunkAddr);
+        const ObjectState *os = state.addressSpace.findObject(mo);
+        if (!os) break;
+        assert(isa<PersistentState>(os) && "volatile object in range!");
+        pmemObjs.push_back(ObjectPair(mo, os));
+      }
+      if (chunkAddr >= start + realSize) return pmemObjs;
+      // Some chunk is no longer bound; fall back to resolution.
+      pmemObjs.clear();
+    }
+  }
+
   for (uint64_t offset = 0; offset < realSize; offset += PersistentState::MaxSize) {
     ref<Expr> offsetExpr = ConstantExpr::create(offset, Expr::Int64);
     ref<Expr> ptrExpr = AddExpr::create(addr, offsetExpr);
@@ -1333,26 +1344,16 @@ void SpecialFunctionHandler::handleIsPersisted(ExecutionState &state,
     klee_error("Not sure how to handle symbolic size argument yet!");
   }
 
-  bool emitErrs = false;
-  std::unordered_set<std::string> errors;
-  for (uint64_t offset = 0; offset < realSize; offset += PersistentState::MaxSize) {
-    ref<Expr> offsetExpr = ConstantExpr::create(offset, Expr::Int64);
-    ref<Expr> ptrExpr = AddExpr::create(addr, offsetExpr);
-    
-    ObjectPair res;
-    bool success;
-    assert(state.addressSpace.resolveOne(state, executor.solver, ptrExpr, res, success));
-    assert(success && "could not resolve one! (isPersisted)");
-
-    const MemoryObject *mo = res.first;
-    PersistentState *ps = dyn_cast<PersistentState>(state.addressSpace.getWriteable(mo, res.second));
-    assert(ps && "trying to check if non-pmem is persisted!");
-
-    bool hasErrs = executor.getPersistenceErrors(state, mo, errors);
-    emitErrs = emitErrs || hasErrs;
-    // ps->flushAll();
+  std::vector<const MemoryObject *> mos;
+  for (ObjectPair &res : getPmemObjsInRange(state, addr, realSize)) {
+    assert(isa<PersistentState>(res.second) && 
+           "trying to check if non-pmem is persisted!");
+    mos.push_back(res.first);
   }
 
+  std::unordered_set<std::string> errors;
+  bool emitErrs = executor.getPersistenceErrors(state, mos, errors);
+
   
   if (emitErrs) {
     assert(errors.size() && "no errors to emit!");
@@ -1362,6 +1363,31 @@ void SpecialFunctionHandler::handleIsPersisted(ExecutionState &state,
   }
 }
 
+void SpecialFunctionHandler::handleFlushRange(ExecutionState &state,
+                                              KInstruction *target,
+                                              std::vector<ref<Expr>> &arguments) {
+  assert(arguments.size()==2 &&
+      "invalid number of arguments to klee_pmem_flush_range");
+
+  ref<ConstantExpr> size = executor.toConstant(state, arguments[1],
+                                               "klee_pmem_flush_range size");
+  executor.executePersistentMemoryFlushRange(state, arguments[0],
+                                             size->getZExtValue());
+}
+
+void SpecialFunctionHandler::handlePersistRange(ExecutionState &state,
+                                                KInstruction *target,
+                                                std::vector<ref<Expr>> &arguments) {
+  assert(arguments.size()==2 &&
+      "invalid number of arguments to klee_pmem_persist_range");
+
+  ref<ConstantExpr> size = executor.toConstant(state, arguments[1],
+                                               "klee_pmem_persist_range size");
+  executor.executePersistentMemoryFlushRange(state, arguments[0],
+                                             size->getZExtValue());
+  executor.executePersistentMemoryFence(state);
+}
+
 void SpecialFunctionHandler::handleIsOrderedBefore(ExecutionState &state,
                                                    KInstruction *target,
                                                    std::vector<ref<Expr> > &arguments) {
@@ -162,6 +162,8 @@ namespace klee {
     HANDLER(handleMarkPersistent);
     HANDLER(handleIsPmem);
     HANDLER(handleIsPersisted);
+    HANDLER(handleFlushRange);
+    HANDLER(handlePersistRange);
     HANDLER(handleIsOrderedBefore);
     /* Thread Scheduling Management */
     HANDLER(handleThreadCreate);
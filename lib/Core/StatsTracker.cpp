@@ -222,45 +222,7 @@ StatsTracker::StatsTracker(Executor &_executor, std::string _objectFilename,
     sqlite3_config(SQLITE_CONFIG_SINGLETHREAD);
     sqlite3_enable_shared_cache(0);
 
-    // open database
-    auto db_filename = executor.interpreterHandler->getOutputFilename("run.stats");
-    if (sqlite3_open(db_filename.c_str(), &statsFile) != SQLITE_OK) {
-      std::ostringstream errorstream;
-      errorstream << "Can't open database: " << sqlite3_errmsg(statsFile);
-      sqlite3_close(statsFile);
-      klee_error("%s", errorstream.str().c_str());
-    }
-
-    // prepare statements
-    if (sqlite3_prepare_v2(statsFile, "BEGIN TRANSACTION", -1, &transactionBeginStmt, nullptr) != SQLITE_OK) {
-      klee_error("Cannot create prepared statement: %s", sqlite3_errmsg(statsFile));
-    }
-
-    if (sqlite3_prepare_v2(statsFile, "END TRANSACTION", -1, &transactionEndStmt, nullptr) != SQLITE_OK) {
-      klee_error("Cannot create prepared statement: %s", sqlite3_errmsg(statsFile));
-    }
-
-    // set options
-    char *zErrMsg;
-    if (sqlite3_exec(statsFile, "PRAGMA synchronous = OFF", nullptr, nullptr, &zErrMsg) != SQLITE_OK) {
-      klee_error("%s", sqlite3ErrToStringAndFree("Can't set options for database: ", zErrMsg).c_str());
-    }
-
-    // note: we use WAL here a) for speed and b) to prevent creation of new file descriptors (as with TRUNCATE)
-    if (sqlite3_exec(statsFile, "PRAGMA journal_mode = WAL", nullptr, nullptr, &zErrMsg) != SQLITE_OK) {
-      klee_error("%s", sqlite3ErrToStringAndFree("Can't set options for database: ", zErrMsg).c_str());
-    }
-
-    // begin transaction
-    auto rc = sqlite3_step(transactionBeginStmt);
-    if (rc != SQLITE_DONE) {
-      klee_warning("Can't begin transaction: %s", sqlite3_errmsg(statsFile));
-    }
-    sqlite3_reset(transactionBeginStmt);
-
-    // create table
-    writeStatsHeader();
-    writeStatsLine();
+    openStatsFile();
 
     if (statsWriteInterval)
       executor.timers.add(std::make_unique<Timer>(statsWriteInterval, [&]{
@@ -277,16 +239,97 @@ StatsTracker::StatsTracker(Executor &_executor, std::string _objectFilename,
   }
 
   if (OutputIStats) {
-    istatsFile = executor.interpreterHandler->openOutputFile("run.istats");
-    if (istatsFile) {
-      if (iStatsWriteInterval)
-        executor.timers.add(std::make_unique<Timer>(iStatsWriteInterval, [&]{
-          writeIStats();
-        }));
-    } else {
-      klee_error("Unable to open instruction level stats file (run.istats).");
-    }
+    openIStatsFile();
+    if (iStatsWriteInterval)
+      executor.timers.add(std::make_unique<Timer>(iStatsWriteInterval, [&]{
+        writeIStats();
+      }));
+  }
+}
+
+void StatsTracker::openStatsFile() {
+  // open database
+  auto db_filename = executor.interpreterHandler->getOutputFilename("run.stats");
+  if (sqlite3_open(db_filename.c_str(), &statsFile) != SQLITE_OK) {
+    std::ostringstream errorstream;
+    errorstream << "Can't open database: " << sqlite3_errmsg(statsFile);
+    sqlite3_close(statsFile);
+    klee_error("%s", errorstream.str().c_str());
+  }
+
+  // prepare statements
+  if (sqlite3_prepare_v2(statsFile, "BEGIN TRANSACTION", -1, &transactionBeginStmt, nullptr) != SQLITE_OK) {
+    klee_error("Cannot create prepared statement: %s", sqlite3_errmsg(statsFile));
+  }
+
+  if (sqlite3_prepare_v2(statsFile, "END TRANSACTION", -1, &transactionEndStmt, nullptr) != SQLITE_OK) {
+    klee_error("Cannot create prepared statement: %s", sqlite3_errmsg(statsFile));
+  }
+
+  // set options
+  char *zErrMsg;
+  if (sqlite3_exec(statsFile, "PRAGMA synchronous = OFF", nullptr, nullptr, &zErrMsg) != SQLITE_OK) {
+    klee_error("%s", sqlite3ErrToStringAndFree("Can't set options for database: ", zErrMsg).c_str());
+  }
+
+  // note: we use WAL here a) for speed and b) to prevent creation of new file descriptors (as with TRUNCATE)
+  if (sqlite3_exec(statsFile, "PRAGMA journal_mode = WAL", nullptr, nullptr, &zErrMsg) != SQLITE_OK) {
+    klee_error("%s", sqlite3ErrToStringAndFree("Can't set options for database: ", zErrMsg).c_str());
+  }
+
+  // begin transaction
+  auto rc = sqlite3_step(transactionBeginStmt);
+  if (rc != SQLITE_DONE) {
+    klee_warning("Can't begin transaction: %s", sqlite3_errmsg(statsFile));
+  }
+  sqlite3_reset(transactionBeginStmt);
+
+  // create table
+  writeStatsHeader();
+  writeStatsLine();
+}
+
+void StatsTracker::openIStatsFile() {
+  istatsFile = executor.interpreterHandler->openOutputFile("run.istats");
+  if (!istatsFile)
+    klee_error("Unable to open instruction level stats file (run.istats).");
+}
+
+void StatsTracker::flushOutputs() {
+  if (istatsFile)
+    istatsFile->flush();
+}
+
+void StatsTracker::reopenOutputs() {
+  // SQLite connections must not be used across a fork, and finalizing or
+  // closing this one would touch the parent's database. Just forget it.
+  if (statsFile) {
+    statsFile = nullptr;
+    transactionBeginStmt = transactionEndStmt = insertStmt = nullptr;
+    openStatsFile();
   }
+
+  if (istatsFile)
+    openIStatsFile();
+}
+
+void StatsTracker::getCoveredInstructions(std::vector<unsigned> &ids) const {
+  if (!OutputIStats)
+    return;
+
+  for (unsigned id = 0, e = executor.kmodule->infos->getMaxID(); id != e; ++id)
+    if (theStatisticManager->getIndexedValue(stats::coveredInstructions, id))
+      ids.push_back(id);
+}
+
+void StatsTracker::markCovered(unsigned id) {
+  if (!OutputIStats || id >= executor.kmodule->infos->getMaxID() ||
+      theStatisticManager->getIndexedValue(stats::coveredInstructions, id))
+    return;
+
+  theStatisticManager->setIndex(id);
+  ++stats::coveredInstructions;
+  stats::uncoveredInstructions += (uint64_t)-1;
 }
 
 StatsTracker::~StatsTracker() {  
@@ -465,7 +508,9 @@ void StatsTracker::writeStatsHeader() {
              << "NvmBugsPerfUniq INTEGER,"
              << "NvmBugsPerfOcc INTEGER,"
              << "NvmBugsCrtUniq INTEGER,"
-             << "NvmBugsCrtOcc INTEGER" 
+             << "NvmBugsCrtOcc INTEGER,"
+             << "NvmContextCacheHits INTEGER,"
+             << "NvmContextCacheMisses INTEGER"
              << ")";
   char *zErrMsg = nullptr;
   if(sqlite3_exec(statsFile, create.str().c_str(), nullptr, nullptr, &zErrMsg)) {
@@ -511,7 +556,9 @@ void StatsTracker::writeStatsHeader() {
              << "NvmBugsPerfUniq ,"
              << "NvmBugsPerfOcc ,"
              << "NvmBugsCrtUniq ,"
-             << "NvmBugsCrtOcc "      
+             << "NvmBugsCrtOcc ,"
+             << "NvmContextCacheHits ,"
+             << "NvmContextCacheMisses "
              << ") VALUES ( "
              << "?, "
              << "?, "
@@ -541,6 +588,8 @@ void StatsTracker::writeStatsHeader() {
              << "?, "
              << "?, "
              << "?, "
+             << "?, "
+             << "?, "
 #ifdef KLEE_ARRAY_DEBUG
              << "?, "
 #endif
@@ -588,8 +637,10 @@ void StatsTracker::writeStatsLine() {
   sqlite3_bind_int64(insertStmt, 27, stats::nvmBugsPerfOccurences);
   sqlite3_bind_int64(insertStmt, 28, stats::nvmBugsCrtUniq);
   sqlite3_bind_int64(insertStmt, 29, stats::nvmBugsCrtOccurences);
+  sqlite3_bind_int64(insertStmt, 30, stats::nvmContextCacheHits);
+  sqlite3_bind_int64(insertStmt, 31, stats::nvmContextCacheMisses);
 #ifdef KLEE_ARRAY_DEBUG
-  sqlite3_bind_int64(insertStmt, 30, stats::arrayHashTime);
+  sqlite3_bind_int64(insertStmt, 32, stats::arrayHashTime);
 #endif
   int errCode = sqlite3_step(insertStmt);
   if(errCode != SQLITE_DONE) klee_error("Error writing stats data: %s", sqlite3_errmsg(statsFile));
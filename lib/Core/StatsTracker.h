@@ -16,6 +16,7 @@
 #include <memory>
 #include <set>
 #include <sqlite3.h>
+#include <vector>
 
 namespace llvm {
   class BranchInst;
@@ -61,6 +62,8 @@ namespace klee {
 
   private:
     void updateStateStatistics(uint64_t addend);
+    void openStatsFile();
+    void openIStatsFile();
     void writeStatsHeader();
     void writeStatsLine();
     void writeIStats();
@@ -92,6 +95,20 @@ namespace klee {
     // called when execution is done and stats files should be flushed
     void done();
 
+    // called before forking exploration workers, so that no buffered output
+    // is written twice
+    void flushOutputs();
+
+    // called in a new exploration worker, to write its statistics to the
+    // worker's own output directory
+    void reopenOutputs();
+
+    // the instructions covered in this process, and marking an instruction
+    // covered by another process, to merge the coverage of exploration
+    // workers
+    void getCoveredInstructions(std::vector<unsigned> &ids) const;
+    void markCovered(unsigned id);
+
     // process stats for a single instruction step, es is the state
     // about to be stepped
     void stepInstruction(ExecutionState &es);
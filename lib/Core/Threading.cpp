@@ -50,13 +50,15 @@ namespace klee {
 /***/
 
 StackFrame::StackFrame(KInstIterator _caller, KFunction *_kf)
-    : caller(_caller), kf(_kf), callPathNode(0), minDistToUncoveredOnReturn(0),
+    : caller(_caller), kf(_kf), callPathNode(0), callStack(nullptr),
+      minDistToUncoveredOnReturn(0),
       varargs(0) {
   locals = new Cell[kf->numRegisters];
 }
 
 StackFrame::StackFrame(const StackFrame &s)
     : caller(s.caller), kf(s.kf), callPathNode(s.callPathNode),
+      callStack(s.callStack),
       allocas(s.allocas),
       minDistToUncoveredOnReturn(s.minDistToUncoveredOnReturn),
       varargs(s.varargs) {
@@ -11,6 +11,8 @@
 
 #include "klee/Config/Version.h"
 #include "klee/ExecutionState.h"
+#include "klee/Expr/Assignment.h"
+#include "klee/Expr/ExprUtil.h"
 #include "klee/Solver/Solver.h"
 #include "klee/Statistics.h"
 #include "klee/TimerStatIncrementer.h"
@@ -105,6 +107,76 @@ bool TimingSolver::getValue(const ExecutionState& state, ref<Expr> expr,
   return success;
 }
 
+bool TimingSolver::getValues(const ExecutionState &state, ref<Expr> expr,
+                             std::vector<ref<ConstantExpr> > &results,
+                             ref<ConstantExpr> ignored) {
+  // Fast path, to avoid timer and OS overhead.
+  if (ConstantExpr *CE = dyn_cast<ConstantExpr>(expr)) {
+    if (ignored.isNull() || CE->compare(*ignored))
+      results.push_back(CE);
+    return true;
+  }
+
+  TimerStatIncrementer timer(stats::solverTime);
+
+  if (simplifyExprs)
+    expr = state.constraints.simplifyExpr(expr);
+
+  // Values found so far are excluded in a copy of the constraints.
+  ConstraintManager blocked(state.constraints);
+  ref<ConstantExpr> last = ignored;
+  bool success = true;
+  for (;;) {
+    if (!last.isNull()) {
+      ref<Expr> other = Expr::createIsZero(EqExpr::create(expr, last));
+      bool mayBeOther;
+      success = solver->mayBeTrue(Query(blocked, other), mayBeOther);
+      if (!success || !mayBeOther)
+        break;
+      blocked.addConstraint(other);
+    }
+
+    ref<ConstantExpr> value;
+    success = solver->getValue(Query(blocked, expr), value);
+    if (!success)
+      break;
+    results.push_back(value);
+    last = value;
+  }
+
+  state.queryCost += timer.delta();
+
+  return success;
+}
+
+bool TimingSolver::getModel(const ExecutionState &state, ref<Expr> expr,
+                            Assignment &model, bool &hasModel) {
+  if (!mayBeTrue(state, expr, hasModel))
+    return false;
+  if (!hasModel)
+    return true;
+
+  std::vector<const Array *> objects;
+  findSymbolicObjects(expr, objects);
+  std::vector<std::vector<unsigned char> > values;
+
+  TimerStatIncrementer timer(stats::solverTime);
+
+  if (simplifyExprs)
+    expr = state.constraints.simplifyExpr(expr);
+
+  // The initial values are a counterexample to the query, i.e., a model of
+  // the constraints in which expr holds.
+  bool success = solver->getInitialValues(
+      Query(state.constraints, Expr::createIsZero(expr)), objects, values);
+  if (success)
+    model = Assignment(objects, values);
+
+  state.queryCost += timer.delta();
+
+  return success;
+}
+
 bool 
 TimingSolver::getInitialValues(const ExecutionState& state, 
                                const std::vector<const Array*>
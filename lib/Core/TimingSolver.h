@@ -17,6 +17,7 @@
 #include <vector>
 
 namespace klee {
+  class Assignment;
   class ExecutionState;
   class Solver;  
 
@@ -60,6 +61,18 @@ namespace klee {
     bool getValue(const ExecutionState &, ref<Expr> expr, 
                   ref<ConstantExpr> &result);
 
+    /// Enumerate every value expr may take (except ignored, if given) by
+    /// asking for a model and then excluding it, so the number of queries is
+    /// proportional to the number of values.
+    bool getValues(const ExecutionState &, ref<Expr> expr,
+                   std::vector<ref<ConstantExpr> > &results,
+                   ref<ConstantExpr> ignored = nullptr);
+
+    /// Find a model in which expr holds, if there is one. The model binds
+    /// every symbolic array expr reads from.
+    bool getModel(const ExecutionState &, ref<Expr> expr,
+                  Assignment &model, bool &hasModel);
+
     bool getInitialValues(const ExecutionState&, 
                           const std::vector<const Array*> &objects,
                           std::vector< std::vector<unsigned char> > &result);
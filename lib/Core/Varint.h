@@ -0,0 +1,86 @@
+//===-- Varint.h ------------------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef KLEE_VARINT_H
+#define KLEE_VARINT_H
+
+#include <stdint.h>
+#include <string>
+
+namespace klee {
+
+  /// Writes LEB128 varints, which keep mostly small numbers small. Used by
+  /// checkpoints and the work stealing messages.
+  class VarintWriter {
+    std::string &out;
+
+  public:
+    explicit VarintWriter(std::string &out) : out(out) {}
+
+    void number(uint64_t n) {
+      do {
+        uint8_t byte = n & 0x7f;
+        n >>= 7;
+        out.push_back(n ? byte | 0x80 : byte);
+      } while (n);
+    }
+
+    void string(const std::string &s) {
+      number(s.size());
+      out.append(s);
+    }
+  };
+
+  class VarintReader {
+    const char *pos, *end;
+
+  public:
+    /// Set once anything was read past the end or malformed.
+    bool failed = false;
+
+    VarintReader(const char *pos, const char *end) : pos(pos), end(end) {}
+
+    bool atEnd() const { return pos == end; }
+    const char *position() const { return pos; }
+
+    uint64_t number() {
+      uint64_t n = 0;
+      for (unsigned shift = 0; shift < 64; shift += 7) {
+        if (pos == end) break;
+        uint8_t byte = *pos++;
+        n |= uint64_t(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+          return n;
+      }
+      failed = true;
+      return 0;
+    }
+
+    /// A count of items that each take at least one byte, which keeps a
+    /// corrupt count from reserving absurd amounts of memory.
+    uint64_t count() {
+      uint64_t n = number();
+      if (n > uint64_t(end - pos)) {
+        failed = true;
+        return 0;
+      }
+      return n;
+    }
+
+    std::string string() {
+      uint64_t n = count();
+      std::string s(pos, n);
+      pos += n;
+      return s;
+    }
+  };
+
+}
+
+#endif /* KLEE_VARINT_H */
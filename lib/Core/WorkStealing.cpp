@@ -0,0 +1,237 @@
+//===-- WorkStealing.cpp ----------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "WorkStealing.h"
+
+#include "Varint.h"
+
+#include "klee/Internal/Support/ErrorHandling.h"
+
+#include <cerrno>
+#include <cstring>
+
+#include <poll.h>
+#include <unistd.h>
+
+using namespace klee;
+
+/// How long to wait before asking a worker that had nothing to give again.
+static const time::Span StealRetryInterval = time::milliseconds(50);
+
+WorkChannel::~WorkChannel() {
+  if (fd >= 0)
+    close(fd);
+}
+
+bool WorkChannel::send(const std::string &message) {
+  if (fd < 0)
+    return false;
+
+  std::string frame;
+  VarintWriter(frame).string(message);
+  const char *data = frame.data();
+  size_t left = frame.size();
+  while (left) {
+    ssize_t n = write(fd, data, left);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    data += n;
+    left -= n;
+  }
+  return true;
+}
+
+bool WorkChannel::receive(std::string &message, bool wait) {
+  for (;;) {
+    // The length may not have arrived completely yet, or the message.
+    VarintReader r(buffer.data(), buffer.data() + buffer.size());
+    uint64_t length = r.number();
+    size_t start = r.position() - buffer.data();
+    if (!r.failed && length <= buffer.size() - start) {
+      message = buffer.substr(start, length);
+      buffer.erase(0, start + length);
+      return true;
+    }
+
+    if (fd < 0)
+      return false;
+
+    if (!wait) {
+      struct pollfd pfd = { fd, POLLIN, 0 };
+      int res = poll(&pfd, 1, 0);
+      if (res < 0 && errno == EINTR)
+        continue;
+      if (res <= 0)
+        return false;
+    }
+
+    char chunk[4096];
+    ssize_t n = read(fd, chunk, sizeof(chunk));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      close(fd);
+      fd = -1;
+      return false;
+    }
+    buffer.append(chunk, n);
+  }
+}
+
+static const char JobKind[] = "job ";
+static const size_t JobKindSize = sizeof(JobKind) - 1;
+
+std::string WorkChannel::encodeJob(const ReplayPath &job) {
+  std::string message(JobKind, JobKindSize);
+  VarintWriter w(message);
+  w.number(job.steppedInstructions);
+  std::vector<unsigned> decisions = job.decisions.toVector();
+  w.number(decisions.size());
+  for (unsigned d : decisions)
+    w.number(d);
+  return message;
+}
+
+bool WorkChannel::decodeJob(const std::string &message, ReplayPath &job) {
+  if (message.compare(0, JobKindSize, JobKind) != 0)
+    return false;
+
+  VarintReader r(message.data() + JobKindSize,
+                 message.data() + message.size());
+  job.steppedInstructions = r.number();
+  job.decisions = DecisionPath();
+  for (uint64_t n = r.count(); n && !r.failed; --n)
+    job.decisions.push_back(r.number());
+  return !r.failed && r.atEnd();
+}
+
+/***/
+
+void WorkCoordinator::addWorker(pid_t pid, int fd) {
+  workers.emplace_back();
+  workers.back().pid = pid;
+  workers.back().channel.reset(new WorkChannel(fd));
+}
+
+void WorkCoordinator::handle(unsigned worker, const std::string &message,
+                             const ResultHandler &handleResult) {
+  Worker &w = workers[worker];
+  std::string kind = message.substr(0, message.find(' '));
+
+  if (kind == "idle") {
+    w.idle = true;
+  } else if (kind == "job") {
+    w.stealPending = false;
+    jobs.push_back(message);
+  } else if (kind == "nojob") {
+    w.stealPending = false;
+  } else if (kind == "done") {
+    w.finished = true;
+  } else {
+    handleResult(worker, message);
+  }
+}
+
+void WorkCoordinator::requestJobs() {
+  unsigned idle = 0, pending = 0;
+  for (const Worker &w : workers) {
+    if (w.finished) continue;
+    if (w.idle) ++idle;
+    if (w.stealPending) ++pending;
+  }
+
+  const auto now = time::getWallTime();
+  for (Worker &w : workers) {
+    if (jobs.size() + pending >= idle)
+      break;
+    if (w.finished || w.idle || w.stealPending ||
+        now - w.lastSteal < StealRetryInterval)
+      continue;
+
+    if (w.channel->send("steal")) {
+      w.stealPending = true;
+      w.lastSteal = now;
+      ++pending;
+    }
+  }
+}
+
+void WorkCoordinator::broadcastExit() {
+  exiting = true;
+  for (Worker &w : workers) {
+    if (!w.finished)
+      w.channel->send("exit");
+  }
+}
+
+void WorkCoordinator::run(const ResultHandler &handleResult,
+                          const std::function<bool()> &halted) {
+  jobs.push_back(WorkChannel::encodeJob({DecisionPath(), 0}));
+
+  for (;;) {
+    bool allIdle = true, anyRunning = false;
+    for (Worker &w : workers) {
+      if (w.finished) continue;
+      anyRunning = true;
+
+      if (!exiting && w.idle && !jobs.empty()) {
+        if (w.channel->send(jobs.front())) {
+          jobs.pop_front();
+          w.idle = false;
+        }
+      }
+
+      if (!w.idle || w.stealPending)
+        allIdle = false;
+    }
+
+    if (!anyRunning)
+      break;
+
+    if (!exiting) {
+      if (halted() || (allIdle && jobs.empty()))
+        broadcastExit();
+      else
+        requestJobs();
+    }
+
+    std::vector<struct pollfd> fds;
+    std::vector<unsigned> polled;
+    for (unsigned i = 0; i < workers.size(); ++i) {
+      if (workers[i].finished) continue;
+      fds.push_back({ workers[i].channel->getFd(), POLLIN, 0 });
+      polled.push_back(i);
+    }
+
+    int res = poll(fds.data(), fds.size(),
+                   StealRetryInterval.toMicroseconds() / 1000);
+    if (res < 0 && errno != EINTR)
+      klee_error("work stealing: poll failed: %s", strerror(errno));
+    if (res <= 0)
+      continue;
+
+    for (unsigned i = 0; i < fds.size(); ++i) {
+      if (!fds[i].revents) continue;
+
+      Worker &w = workers[polled[i]];
+      std::string message;
+      while (!w.finished && w.channel->receive(message, false))
+        handle(polled[i], message, handleResult);
+
+      if (!w.finished && w.channel->closed()) {
+        klee_warning("exploration worker %d exited unexpectedly, its "
+                     "remaining states are lost", w.pid);
+        w.finished = true;
+      }
+    }
+  }
+}
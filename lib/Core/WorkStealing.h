@@ -0,0 +1,106 @@
+//===-- WorkStealing.h ------------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef KLEE_WORKSTEALING_H
+#define KLEE_WORKSTEALING_H
+
+#include "ReplayTree.h"
+
+#include "klee/Internal/System/Time.h"
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+namespace klee {
+
+  /// One end of the connection between the coordinator and an exploration
+  /// worker (see --work-stealing). Every message is preceded by its length,
+  /// and its first word is its kind:
+  ///
+  ///   coordinator -> worker:  job,  steal,  exit
+  ///   worker -> coordinator:  idle,  job,  nojob,  done,
+  ///                           and any result lines (see WorkCoordinator)
+  ///
+  /// A job is a state that was not explored yet, as the path that leads to
+  /// it from the initial state (see ReplayPath). Its message is binary: the
+  /// instruction count, the number of decisions and the decisions, as
+  /// varints after the kind.
+  class WorkChannel {
+    int fd;
+    std::string buffer;
+
+  public:
+    explicit WorkChannel(int fd) : fd(fd) {}
+    ~WorkChannel();
+
+    WorkChannel(const WorkChannel &) = delete;
+    WorkChannel &operator=(const WorkChannel &) = delete;
+
+    int getFd() const { return fd; }
+
+    /// Returns false if the other end is gone.
+    bool send(const std::string &message);
+
+    /// Get the next message. If wait is false, only messages that already
+    /// arrived are returned. Returns false if there is none, or the other
+    /// end is gone (then \ref closed is true).
+    bool receive(std::string &message, bool wait);
+
+    bool closed() const { return fd < 0; }
+
+    static std::string encodeJob(const ReplayPath &job);
+    static bool decodeJob(const std::string &message, ReplayPath &job);
+  };
+
+  /// Hands out the subtrees of the execution tree to the workers. Idle
+  /// workers get the queued jobs, and while there are none, the busy
+  /// workers are asked to give up one of their states each.
+  class WorkCoordinator {
+  public:
+    typedef std::function<void(unsigned, const std::string &)> ResultHandler;
+
+  private:
+    struct Worker {
+      pid_t pid;
+      std::unique_ptr<WorkChannel> channel;
+      bool idle = false;
+      bool finished = false;
+      bool stealPending = false;
+      time::Point lastSteal;
+    };
+
+    std::vector<Worker> workers;
+    std::deque<std::string> jobs;
+    bool exiting = false;
+
+    void handle(unsigned worker, const std::string &message,
+                const ResultHandler &handleResult);
+    void requestJobs();
+    void broadcastExit();
+
+  public:
+    void addWorker(pid_t pid, int fd);
+
+    /// Explore the whole tree, starting with the initial state, and return
+    /// once every worker is done. Messages other than the ones above are
+    /// results, which are passed to handleResult along with the index of
+    /// the worker (in the order they were added). halted is polled
+    /// regularly; once it returns true, the workers are told to stop.
+    void run(const ResultHandler &handleResult,
+             const std::function<bool()> &halted);
+  };
+
+}
+
+#endif /* KLEE_WORKSTEALING_H */
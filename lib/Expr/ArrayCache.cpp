@@ -14,6 +14,15 @@ ArrayCache::~ArrayCache() {
        ai != e; ++ai) {
     delete *ai;
   }
+  for (const Array *array : sharedConstantArrays)
+    delete array;
+}
+
+unsigned ConstantArrayHashFn::operator()(const Array *array) const {
+  unsigned res = array->domain * Expr::MAGIC_HASH_CONSTANT + array->range;
+  for (const ref<ConstantExpr> &value : array->constantValues)
+    res = (res * Expr::MAGIC_HASH_CONSTANT) + value->hash();
+  return res;
 }
 
 const Array *
@@ -44,4 +53,21 @@ ArrayCache::CreateArray(const std::string &_name, uint64_t _size,
     return array;
   }
 }
+
+const Array *ArrayCache::CreateSharedConstantArray(
+    const std::string &_name, uint64_t _size,
+    const ref<ConstantExpr> *constantValuesBegin,
+    const ref<ConstantExpr> *constantValuesEnd, Expr::Width _domain,
+    Expr::Width _range) {
+  assert(constantValuesBegin != constantValuesEnd &&
+         "shared arrays must be constant");
+  const Array *array = new Array(_name, _size, constantValuesBegin,
+                                 constantValuesEnd, _domain, _range);
+  auto success = sharedConstantArrays.insert(array);
+  if (!success.second) {
+    delete array;
+    array = *success.first;
+  }
+  return array;
+}
 }
@@ -8,6 +8,9 @@
 //===----------------------------------------------------------------------===//
 
 #include "klee/Internal/Module/KInstruction.h"
+
+#include "llvm/IR/Instructions.h"
+
 #include <string>
 
 using namespace llvm;
@@ -15,6 +18,21 @@ using namespace klee;
 
 /***/
 
+unsigned KInstruction::computeFlags(const Instruction *inst) {
+  unsigned flags = 0;
+
+  if (isa<StoreInst>(inst)) {
+    flags |= IsStore;
+  } else if (isa<ReturnInst>(inst)) {
+    flags |= IsReturn;
+  } else if (isa<CallInst>(inst) || isa<InvokeInst>(inst)) {
+    flags |= IsCall;
+    if (inst->getType()->isPtrOrPtrVectorTy()) flags |= ReturnsPointer;
+  }
+
+  return flags;
+}
+
 KInstruction::~KInstruction() {
   delete[] operands;
 }
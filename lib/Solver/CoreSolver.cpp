@@ -57,4 +57,13 @@ Solver *createCoreSolver(CoreSolverType cst) {
     llvm_unreachable("Unsupported CoreSolverType");
   }
 }
+
+void renewForkedSolverMemory() {
+#ifdef ENABLE_STP
+  renewSTPSharedMemory();
+#endif
+#ifdef ENABLE_METASMT
+  renewMetaSMTSharedMemory();
+#endif
+}
 }
@@ -71,6 +71,15 @@ static const unsigned shared_memory_size = 1 << 16;
 static const unsigned shared_memory_size = 1 << 20;
 #endif
 
+static void allocateSharedMemory() {
+  shared_memory_id =
+      shmget(IPC_PRIVATE, shared_memory_size, IPC_CREAT | 0700);
+  assert(shared_memory_id >= 0 && "shmget failed");
+  shared_memory_ptr = (unsigned char *)shmat(shared_memory_id, NULL, 0);
+  assert(shared_memory_ptr != (void *)-1 && "shmat failed");
+  shmctl(shared_memory_id, IPC_RMID, NULL);
+}
+
 namespace klee {
 
 template <typename SolverContext> class MetaSMTSolverImpl : public SolverImpl {
@@ -123,14 +132,8 @@ MetaSMTSolverImpl<SolverContext>::MetaSMTSolverImpl(
   assert(_solver && "unable to create MetaSMTSolver");
   assert(_builder && "unable to create MetaSMTBuilder");
 
-  if (_useForked) {
-    shared_memory_id =
-        shmget(IPC_PRIVATE, shared_memory_size, IPC_CREAT | 0700);
-    assert(shared_memory_id >= 0 && "shmget failed");
-    shared_memory_ptr = (unsigned char *)shmat(shared_memory_id, NULL, 0);
-    assert(shared_memory_ptr != (void *)-1 && "shmat failed");
-    shmctl(shared_memory_id, IPC_RMID, NULL);
-  }
+  if (_useForked)
+    allocateSharedMemory();
 }
 
 template <typename SolverContext>
@@ -473,5 +476,12 @@ Solver *createMetaSMTSolver() {
   return coreSolver;
 }
 
+void renewMetaSMTSharedMemory() {
+  if (!shared_memory_ptr)
+    return;
+  shmdt(shared_memory_ptr);
+  allocateSharedMemory();
+}
+
 }
 #endif // ENABLE_METASMT
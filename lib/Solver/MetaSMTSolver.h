@@ -27,6 +27,9 @@ public:
 /// createMetaSMTSolver - Create a solver using the metaSMT backend set by
 /// the option MetaSMTBackend.
 Solver *createMetaSMTSolver();
+
+/// See renewForkedSolverMemory.
+void renewMetaSMTSharedMemory();
 }
 
 #endif /* KLEE_METASMTSOLVER_H */
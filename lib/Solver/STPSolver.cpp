@@ -57,6 +57,17 @@ static const unsigned shared_memory_size = 1 << 16;
 static const unsigned shared_memory_size = 1 << 20;
 #endif
 
+static void allocateSharedMemory() {
+  shared_memory_id =
+      shmget(IPC_PRIVATE, shared_memory_size, IPC_CREAT | 0700);
+  if (shared_memory_id < 0)
+    llvm::report_fatal_error("unable to allocate shared memory region");
+  shared_memory_ptr = (unsigned char *)shmat(shared_memory_id, nullptr, 0);
+  if (shared_memory_ptr == (void *)-1)
+    llvm::report_fatal_error("unable to attach shared memory region");
+  shmctl(shared_memory_id, IPC_RMID, nullptr);
+}
+
 static void stp_error_handler(const char *err_msg) {
   fprintf(stderr, "error: STP Error: %s\n", err_msg);
   abort();
@@ -109,14 +120,7 @@ STPSolverImpl::STPSolverImpl(bool useForkedSTP, bool optimizeDivides)
 
   if (useForkedSTP) {
     assert(shared_memory_id == 0 && "shared memory id already allocated");
-    shared_memory_id =
-        shmget(IPC_PRIVATE, shared_memory_size, IPC_CREAT | 0700);
-    if (shared_memory_id < 0)
-      llvm::report_fatal_error("unable to allocate shared memory region");
-    shared_memory_ptr = (unsigned char *)shmat(shared_memory_id, nullptr, 0);
-    if (shared_memory_ptr == (void *)-1)
-      llvm::report_fatal_error("unable to attach shared memory region");
-    shmctl(shared_memory_id, IPC_RMID, nullptr);
+    allocateSharedMemory();
   }
 }
 
@@ -378,5 +382,12 @@ void STPSolver::setCoreSolverTimeout(time::Span timeout) {
   impl->setCoreSolverTimeout(timeout);
 }
 
+void renewSTPSharedMemory() {
+  if (!shared_memory_ptr)
+    return;
+  shmdt(shared_memory_ptr);
+  allocateSharedMemory();
+}
+
 } // klee
 #endif // ENABLE_STP
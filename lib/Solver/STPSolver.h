@@ -34,6 +34,9 @@ public:
   /// is off.
   virtual void setCoreSolverTimeout(time::Span timeout);
 };
+
+/// See renewForkedSolverMemory.
+void renewSTPSharedMemory();
 }
 
 #endif /* KLEE_STPSOLVER_H */
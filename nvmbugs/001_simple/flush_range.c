@@ -0,0 +1,28 @@
+#include <string.h>
+#include <xmmintrin.h>	// _mm_sfence
+
+#include "klee/klee.h"
+
+#define BUF_LEN 16384
+
+int main() {
+
+  char pmemaddr[BUF_LEN];
+  klee_pmem_mark_persistent(pmemaddr, BUF_LEN, "pmem_stack_buffer");
+
+  // Spans four cache lines, starting and ending in the middle of one.
+  memset(&pmemaddr[10], 1, 200);
+  klee_pmem_flush_range(&pmemaddr[10], 200);
+  _mm_sfence();
+
+  klee_pmem_check_persisted(pmemaddr, BUF_LEN);
+
+  // The lines this shares with the first range are persisted already, and
+  // reported as unnecessary flushes. The last one is persisted.
+  pmemaddr[300] = 2;
+  klee_pmem_persist_range(&pmemaddr[100], 201);
+
+  klee_pmem_check_persisted(pmemaddr, BUF_LEN);
+
+  return 0;
+}
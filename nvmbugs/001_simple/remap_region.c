@@ -0,0 +1,33 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "klee/klee.h"
+
+// The size of the chunks klee_pmem_alloc_pmem maps a region with.
+#define CHUNK_LEN (4 * 4096)
+#define REGION_LEN (2 * CHUNK_LEN)
+
+int main() {
+
+  char *pmemaddr = klee_pmem_alloc_pmem(REGION_LEN, "pmem_region", true, NULL);
+  pmemaddr[0] = 1;
+  klee_pmem_persist_range(pmemaddr, 1);
+  klee_pmem_check_persisted(pmemaddr, REGION_LEN);
+
+  // Unmap the region, then map the same range again with new objects.
+  for (size_t off = 0; off < REGION_LEN; off += CHUNK_LEN) {
+    klee_undefine_fixed_object(pmemaddr + off);
+  }
+  for (size_t off = 0; off < REGION_LEN; off += CHUNK_LEN) {
+    klee_define_fixed_object(pmemaddr + off, CHUNK_LEN);
+  }
+  klee_pmem_mark_persistent(pmemaddr, REGION_LEN, "pmem_remapped");
+
+  // Both chunks have to be found again, not the ones of the old region.
+  pmemaddr[CHUNK_LEN - 1] = 2;
+  pmemaddr[CHUNK_LEN] = 3;
+  klee_pmem_persist_range(&pmemaddr[CHUNK_LEN - 1], 2);
+  klee_pmem_check_persisted(pmemaddr, REGION_LEN);
+
+  return 0;
+}
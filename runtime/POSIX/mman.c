@@ -296,6 +296,21 @@ int munmap(void *start, size_t length) {
   return syscall(__NR_munmap, start, actual_size);
 }
 
+int msync(void *addr, size_t length, int flags) __attribute__((weak));
+int msync(void *addr, size_t length, int flags) {
+  size_t actual_size = __concretize_size(length);
+  void *end = addr + actual_size;
+  int entry_index = find_index(addr, end);
+  if (entry_index >= 0) {
+    // Writing back a mapping of a persistent file persists the range, like
+    // pmem_persist.
+    klee_pmem_persist_range(addr, actual_size);
+    return 0;
+  }
+
+  return syscall(__NR_msync, __concretize_ptr(addr), actual_size, flags);
+}
+
 /**
  * Stubs.
  */
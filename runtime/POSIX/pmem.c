@@ -0,0 +1,82 @@
+//===-- pmem.c ------------------------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+/**
+ * Models of the libpmem flush and copy functions, for programs that are not
+ * linked with libpmem itself. A range is flushed in one step with
+ * klee_pmem_flush_range rather than a loop of clwb over its cache lines.
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "klee/klee.h"
+
+void pmem_drain(void) __attribute__((weak));
+void pmem_drain(void) {
+  __builtin_ia32_sfence();
+}
+
+void pmem_flush(const void *addr, size_t len) __attribute__((weak));
+void pmem_flush(const void *addr, size_t len) {
+  klee_pmem_flush_range((void *)addr, len);
+}
+
+void pmem_persist(const void *addr, size_t len) __attribute__((weak));
+void pmem_persist(const void *addr, size_t len) {
+  klee_pmem_persist_range((void *)addr, len);
+}
+
+void *pmem_memcpy_nodrain(void *pmemdest, const void *src, size_t len)
+    __attribute__((weak));
+void *pmem_memcpy_nodrain(void *pmemdest, const void *src, size_t len) {
+  memcpy(pmemdest, src, len);
+  klee_pmem_flush_range(pmemdest, len);
+  return pmemdest;
+}
+
+void *pmem_memcpy_persist(void *pmemdest, const void *src, size_t len)
+    __attribute__((weak));
+void *pmem_memcpy_persist(void *pmemdest, const void *src, size_t len) {
+  memcpy(pmemdest, src, len);
+  klee_pmem_persist_range(pmemdest, len);
+  return pmemdest;
+}
+
+void *pmem_memmove_nodrain(void *pmemdest, const void *src, size_t len)
+    __attribute__((weak));
+void *pmem_memmove_nodrain(void *pmemdest, const void *src, size_t len) {
+  memmove(pmemdest, src, len);
+  klee_pmem_flush_range(pmemdest, len);
+  return pmemdest;
+}
+
+void *pmem_memmove_persist(void *pmemdest, const void *src, size_t len)
+    __attribute__((weak));
+void *pmem_memmove_persist(void *pmemdest, const void *src, size_t len) {
+  memmove(pmemdest, src, len);
+  klee_pmem_persist_range(pmemdest, len);
+  return pmemdest;
+}
+
+void *pmem_memset_nodrain(void *pmemdest, int c, size_t len)
+    __attribute__((weak));
+void *pmem_memset_nodrain(void *pmemdest, int c, size_t len) {
+  memset(pmemdest, c, len);
+  klee_pmem_flush_range(pmemdest, len);
+  return pmemdest;
+}
+
+void *pmem_memset_persist(void *pmemdest, int c, size_t len)
+    __attribute__((weak));
+void *pmem_memset_persist(void *pmemdest, int c, size_t len) {
+  memset(pmemdest, c, len);
+  klee_pmem_persist_range(pmemdest, len);
+  return pmemdest;
+}
@@ -191,5 +191,7 @@ void *klee_pmem_mark_persistent(void *addr, size_t size, const char *name) {
   return addr;
 }
 void klee_pmem_check_persisted(void *addr, size_t size) {}
+void klee_pmem_flush_range(void *addr, size_t size) {}
+void klee_pmem_persist_range(void *addr, size_t size) {}
 void klee_pmem_check_ordered_before(void *addrA, size_t sizeA,
                                     void *addrB, size_t sizeB) {}
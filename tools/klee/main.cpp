@@ -358,6 +358,8 @@ public:
   unsigned getNumPathsExplored() { return m_pathsExplored; }
   void incPathsExplored() { m_pathsExplored++; }
 
+  void redirectOutputToWorker(unsigned worker);
+
   void setInterpreter(Interpreter *i);
 
   void processTestCase(const ExecutionState  &state,
@@ -456,6 +458,32 @@ KleeHandler::~KleeHandler() {
   fclose(klee_message_file);
 }
 
+void KleeHandler::redirectOutputToWorker(unsigned worker) {
+  llvm::sys::path::append(m_outputDirectory,
+                          "worker-" + std::to_string(worker));
+  if (mkdir(m_outputDirectory.c_str(), 0775) < 0)
+    klee_error("cannot create \"%s\": %s", m_outputDirectory.c_str(),
+               strerror(errno));
+
+  // These are copies of the parent's descriptors (flushed before forking),
+  // so closing them here leaves the parent's files alone.
+  fclose(klee_warning_file);
+  fclose(klee_message_file);
+
+  std::string file_path = getOutputFilename("warnings.txt");
+  if ((klee_warning_file = fopen(file_path.c_str(), "w")) == NULL)
+    klee_error("cannot open file \"%s\": %s", file_path.c_str(), strerror(errno));
+
+  file_path = getOutputFilename("messages.txt");
+  if ((klee_message_file = fopen(file_path.c_str(), "w")) == NULL)
+    klee_error("cannot open file \"%s\": %s", file_path.c_str(), strerror(errno));
+
+  m_infoFile = openOutputFile("info");
+  *m_infoFile << "Exploration worker " << worker << "\n"
+              << "PID: " << getpid() << "\n";
+  m_infoFile->flush();
+}
+
 void KleeHandler::setInterpreter(Interpreter *i) {
   m_interpreter = i;
 
@@ -822,8 +850,10 @@ static const char *modelledExternals[] = {
   "klee_close_merge",
   "klee_pmem_alloc_pmem",
   "klee_pmem_check_persisted",
+  "klee_pmem_flush_range",
   "klee_pmem_mark_persistent",
   "klee_pmem_is_pmem",
+  "klee_pmem_persist_range",
   "klee_prefer_cex",
   "klee_posix_prefer_cex",
   "klee_print_expr",
@@ -0,0 +1,48 @@
+#include "klee/Internal/ADT/DecisionPath.h"
+#include "gtest/gtest.h"
+
+#include <vector>
+
+using namespace klee;
+
+TEST(DecisionPathTest, SharedPrefix) {
+  DecisionPath path;
+  ASSERT_TRUE(path.empty());
+  ASSERT_EQ(0u, path.size());
+
+  path.push_back(1);
+  path.push_back(0);
+
+  DecisionPath left = path, right = path;
+  left.push_back(0);
+  right.push_back(1);
+
+  ASSERT_EQ(2u, path.size());
+  ASSERT_EQ(3u, left.size());
+  ASSERT_EQ(std::vector<unsigned>({1, 0}), path.toVector());
+  ASSERT_EQ(std::vector<unsigned>({1, 0, 0}), left.toVector());
+  ASSERT_EQ(std::vector<unsigned>({1, 0, 1}), right.toVector());
+
+  ASSERT_EQ(1u, right.back());
+  ASSERT_EQ(path.identity(), left.parent().identity());
+  ASSERT_EQ(left.parent().identity(), right.parent().identity());
+  ASSERT_EQ(nullptr, DecisionPath().identity());
+
+  // The prefix outlives the path it was copied from.
+  path = DecisionPath();
+  ASSERT_EQ(std::vector<unsigned>({1, 0, 0}), left.toVector());
+  DecisionPath prefix = right.parent();
+  right = left = DecisionPath();
+  ASSERT_EQ(std::vector<unsigned>({1, 0}), prefix.toVector());
+}
+
+TEST(DecisionPathTest, LongPath) {
+  // Released iteratively, without a stack frame per decision.
+  DecisionPath path;
+  for (unsigned i = 0; i < 1000000; ++i)
+    path.push_back(i % 2);
+  ASSERT_EQ(1000000u, path.size());
+  ASSERT_EQ(1u, path.back());
+  path = DecisionPath();
+  ASSERT_TRUE(path.empty());
+}
@@ -264,4 +264,35 @@ TEST(ExprTest, ReadExprFoldingSymbolicIndexUpdate) {
     EXPECT_EQ(Expr::Read, read.get()->getKind());
   }
 }
+
+TEST(ExprTest, SharedConstantArrays) {
+  unsigned size = 5;
+  std::vector<ref<ConstantExpr> > Contents(size);
+  for (unsigned i = 0; i < size; ++i)
+    Contents[i] = ConstantExpr::create(i + 1, Expr::Int8);
+  ArrayCache ac;
+
+  // Equal contents share one array, whatever the name.
+  const Array *array = ac.CreateSharedConstantArray(
+      "snap1", size, &Contents[0], &Contents[0] + size);
+  const Array *same = ac.CreateSharedConstantArray(
+      "snap2", size, &Contents[0], &Contents[0] + size);
+  EXPECT_EQ(array, same);
+  EXPECT_EQ("snap1", same->name);
+
+  Contents[2] = ConstantExpr::create(42, Expr::Int8);
+  const Array *other = ac.CreateSharedConstantArray(
+      "snap3", size, &Contents[0], &Contents[0] + size);
+  EXPECT_NE(array, other);
+
+  // So do only arrays of the same domain and range.
+  const Array *wide = ac.CreateSharedConstantArray(
+      "snap4", size, &Contents[0], &Contents[0] + size, Expr::Int64);
+  EXPECT_NE(other, wide);
+
+  // Plain constant arrays are never shared.
+  const Array *plain =
+      ac.CreateArray("arr", size, &Contents[0], &Contents[0] + size);
+  EXPECT_NE(other, plain);
+}
 }
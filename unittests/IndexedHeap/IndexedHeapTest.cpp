@@ -0,0 +1,128 @@
+#include "klee/Internal/ADT/IndexedHeap.h"
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <vector>
+
+using namespace klee;
+
+namespace {
+/// Pop everything, checking that the keys come out greatest first.
+template <class Heap> std::vector<int> drain(Heap &heap) {
+  std::vector<int> items;
+  unsigned last = 0;
+  while (!heap.empty()) {
+    if (!items.empty()) {
+      EXPECT_GE(last, heap.topKey());
+    }
+    last = heap.topKey();
+    items.push_back(heap.top());
+    heap.remove(heap.top());
+    EXPECT_FALSE(heap.inHeap(items.back()));
+  }
+  return items;
+}
+} // namespace
+
+TEST(IndexedHeapTest, Insert) {
+  IndexedHeap<int, unsigned> heap;
+  ASSERT_TRUE(heap.empty());
+
+  heap.insert(1, 10);
+  heap.insert(2, 30);
+  heap.insert(3, 20);
+  ASSERT_EQ(3u, heap.size());
+  ASSERT_TRUE(heap.inHeap(3));
+  ASSERT_FALSE(heap.inHeap(4));
+  ASSERT_EQ(2, heap.top());
+  ASSERT_EQ(30u, heap.topKey());
+  ASSERT_EQ(20u, heap.getKey(3));
+
+  // Inserting an item again changes its key.
+  heap.insert(1, 40);
+  ASSERT_EQ(3u, heap.size());
+  ASSERT_EQ(1, heap.top());
+  ASSERT_EQ(40u, heap.getKey(1));
+}
+
+TEST(IndexedHeapTest, Update) {
+  IndexedHeap<int, unsigned> heap;
+  for (int i = 0; i < 20; ++i)
+    heap.insert(i, 10 * i);
+  ASSERT_EQ(19, heap.top());
+
+  // Up past the top.
+  heap.update(3, 1000);
+  ASSERT_EQ(3, heap.top());
+  ASSERT_EQ(1000u, heap.getKey(3));
+
+  // Down below everything.
+  heap.update(3, 0);
+  heap.update(19, 1);
+  ASSERT_EQ(18, heap.top());
+
+  // An interior item up to the top.
+  heap.update(10, 500);
+  ASSERT_EQ(10, heap.top());
+
+  std::vector<int> items = drain(heap);
+  ASSERT_EQ(20u, items.size());
+  ASSERT_EQ(10, items.front());
+}
+
+TEST(IndexedHeapTest, Remove) {
+  IndexedHeap<int, unsigned> heap;
+  for (int i = 0; i < 20; ++i)
+    heap.insert(i, (i * 7) % 20);
+
+  // The last entry of the array, an interior one and the top.
+  heap.remove(19);
+  heap.remove(5);
+  heap.remove(heap.top());
+  // Removing what is not in the heap does nothing.
+  heap.remove(5);
+  heap.remove(100);
+  ASSERT_EQ(17u, heap.size());
+  ASSERT_FALSE(heap.inHeap(5));
+
+  std::vector<int> items = drain(heap);
+  ASSERT_EQ(17u, items.size());
+
+  heap.insert(1, 1);
+  heap.remove(1);
+  ASSERT_TRUE(heap.empty());
+  heap.insert(2, 2);
+  heap.clear();
+  ASSERT_TRUE(heap.empty());
+  ASSERT_FALSE(heap.inHeap(2));
+}
+
+TEST(IndexedHeapTest, TopOrdering) {
+  // With std::greater, the top is the least key.
+  IndexedHeap<int, unsigned, std::greater<unsigned>, 2> heap;
+  std::map<int, unsigned> keys;
+  unsigned seed = 1;
+  for (int step = 0; step < 2000; ++step) {
+    seed = seed * 1103515245 + 12345;
+    int item = (seed >> 16) % 64;
+    unsigned key = (seed >> 8) % 1000;
+    if (step % 5 == 4) {
+      heap.remove(item);
+      keys.erase(item);
+    } else {
+      heap.insert(item, key);
+      keys[item] = key;
+    }
+
+    ASSERT_EQ(keys.size(), heap.size());
+    if (keys.empty())
+      continue;
+    unsigned least = keys.begin()->second;
+    for (const auto &p : keys)
+      least = std::min(least, p.second);
+    ASSERT_EQ(least, heap.topKey());
+    ASSERT_EQ(least, keys[heap.top()]);
+  }
+}